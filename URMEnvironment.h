@@ -0,0 +1,141 @@
+#ifndef URMENVIRONMENT_H
+#define URMENVIRONMENT_H
+
+#include "URMHal.h"
+
+/**
+ * Default air temperature used by URMEnvironment, in tenths of degree Celsius.
+ */
+#define URM_DEFAULT_AIR_TEMPERATURE 200 // 20.0 C
+
+/**
+ * Default relative humidity used by URMEnvironment, in percents.
+ */
+#define URM_DEFAULT_RELATIVE_HUMIDITY 50 // %
+
+/**
+ * A class describing the air the sound travels through. The speed of sound changes by about
+ * 0.6 m/s per degree Celsius (about 5% between 5 C and 35 C), so the sensors that just measure
+ * the time of flight (like HC-SR04) need it to get precise distance. Pass the same instance to
+ * URMSensor::setEnvironment() or URMSensorArray::setEnvironment() for all sensors working
+ * in the same place, and update it when your thermometer reports new values.
+ *
+ * The conversion factors are computed only when the environment changes, so converting
+ * the pulse width to distance still takes a single multiplication.
+ *
+ * @author Andrey A. Vasenev
+ */
+class URMEnvironment
+{
+	public:
+		/**
+		 * Constructor. The environment is initialized with URM_DEFAULT_AIR_TEMPERATURE and
+		 * URM_DEFAULT_RELATIVE_HUMIDITY.
+		 */
+		URMEnvironment()
+		{
+			_temperature = URM_DEFAULT_AIR_TEMPERATURE;
+			_humidity = URM_DEFAULT_RELATIVE_HUMIDITY;
+
+			computeFactors();
+		}
+
+		/**
+		 * Sets the air temperature and humidity.
+		 *
+		 * @param temperature Air temperature in tenths of degree Celsius (for example, 215 means 21.5 C).
+		 *
+		 * @param humidity Relative humidity in percents.
+		 */
+		void setEnvironment(int temperature, byte humidity)
+		{
+			if ((temperature == _temperature) && (humidity == _humidity)) return;
+
+			_temperature = temperature;
+			_humidity = humidity;
+
+			computeFactors();
+		}
+
+		/**
+		 * Sets the air temperature, keeping the humidity.
+		 *
+		 * @param temperature Air temperature in tenths of degree Celsius (for example, 215 means 21.5 C).
+		 */
+		void setAirTemperature(int temperature)
+		{
+			setEnvironment(temperature, _humidity);
+		}
+
+		/**
+		 * Sets the relative humidity, keeping the temperature.
+		 *
+		 * @param humidity Relative humidity in percents.
+		 */
+		void setRelativeHumidity(byte humidity)
+		{
+			setEnvironment(_temperature, humidity);
+		}
+
+		/**
+		 * Retrieves the air temperature in tenths of degree Celsius.
+		 */
+		int getAirTemperature()
+		{
+			return _temperature;
+		}
+
+		/**
+		 * Retrieves the relative humidity in percents.
+		 */
+		byte getRelativeHumidity()
+		{
+			return _humidity;
+		}
+
+		/**
+		 * Retrieves the speed of sound in mm/s.
+		 */
+		long getSpeedOfSound()
+		{
+			return _speedOfSound;
+		}
+
+		/**
+		 * Retrieves the distance in mm per 1 us of the pulse, in 16.16 fixed-point format.
+		 */
+		unsigned long getMmPerUsQ16()
+		{
+			return _mmPerUsQ16;
+		}
+
+		/**
+		 * Retrieves the distance in cm per 1 us of the pulse, in 16.16 fixed-point format.
+		 */
+		unsigned long getCmPerUsQ16()
+		{
+			return _cmPerUsQ16;
+		}
+
+	private:
+		int _temperature;
+		byte _humidity;
+
+		long _speedOfSound;
+
+		unsigned long _mmPerUsQ16;
+		unsigned long _cmPerUsQ16;
+
+		void computeFactors()
+		{
+			// c = 331.3 m/s + 0.606 m/s per C + 0.0124 m/s per % of humidity (in mm/s here).
+			_speedOfSound = 331300L + (606L * _temperature) / 10 + (124L * _humidity) / 10;
+
+			// The sound travels to the target and back, so 1 us of the pulse is (c / 2) * 1e-6
+			// of distance. The factors are in 16.16 fixed-point format: c * 65536 / 2e6 mm/us.
+			_mmPerUsQ16 = ((unsigned long)_speedOfSound * 4096) / 125000;
+			_cmPerUsQ16 = ((unsigned long)_speedOfSound * 4096) / 1250000;
+		}
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef URMFASTGPIO_H
+#define URMFASTGPIO_H
+
+#include "URMHal.h"
+
+/**
+ * Direct access to GPIO registers used with URM_USE_PORTS_DIRECTLY. Every supported architecture
+ * provides the same set of functions: the register to read the pin from, the output latch register,
+ * the registers to set and to clear the pin, and its mask.
+ *
+ * Writing the pins never disturbs the other pins of the port, even if interrupt handlers
+ * change them at the same time:
+ * - the architectures that have separate set and clear registers (URM_PORT_HAS_SET_CLEAR) write
+ *   the pins with single stores;
+ * - on AVR, both registers are the PINx register (URM_PORT_HAS_TOGGLE): writing 1 to its bit
+ *   toggles the pin, so the latch is read to find out which pins have to be toggled;
+ * - on the oldest AVRs without the toggle, PORTx is changed by read-modify-write with interrupts
+ *   disabled.
+ *
+ * Supported: AVR, SAM (Arduino Due), SAMD (Arduino Zero, MKR boards), RP2040 and ESP32. On other
+ * boards URM_USE_PORTS_DIRECTLY is turned off.
+ */
+
+#if defined(ARDUINO_ARCH_SAM)
+	#define URM_FAST_GPIO_AVAILABLE
+	#define URM_PORT_HAS_SET_CLEAR
+
+	typedef volatile uint32_t URMPortRegister;
+	typedef uint32_t URMPortMask;
+
+	static inline URMPortRegister* urmPinInputRegister(byte pin) { return (URMPortRegister*)&g_APinDescription[pin].pPort->PIO_PDSR; }
+	static inline URMPortRegister* urmPinOutputRegister(byte pin) { return (URMPortRegister*)&g_APinDescription[pin].pPort->PIO_ODSR; }
+	static inline URMPortRegister* urmPinSetRegister(byte pin) { return &g_APinDescription[pin].pPort->PIO_SODR; }
+	static inline URMPortRegister* urmPinClearRegister(byte pin) { return &g_APinDescription[pin].pPort->PIO_CODR; }
+	static inline URMPortMask urmPinMask(byte pin) { return g_APinDescription[pin].ulPin; }
+
+#elif defined(ARDUINO_ARCH_SAMD)
+	#define URM_FAST_GPIO_AVAILABLE
+	#define URM_PORT_HAS_SET_CLEAR
+
+	typedef volatile uint32_t URMPortRegister;
+	typedef uint32_t URMPortMask;
+
+	static inline URMPortRegister* urmPinInputRegister(byte pin) { return (URMPortRegister*)&PORT->Group[g_APinDescription[pin].ulPort].IN.reg; }
+	static inline URMPortRegister* urmPinOutputRegister(byte pin) { return (URMPortRegister*)&PORT->Group[g_APinDescription[pin].ulPort].OUT.reg; }
+	static inline URMPortRegister* urmPinSetRegister(byte pin) { return &PORT->Group[g_APinDescription[pin].ulPort].OUTSET.reg; }
+	static inline URMPortRegister* urmPinClearRegister(byte pin) { return &PORT->Group[g_APinDescription[pin].ulPort].OUTCLR.reg; }
+	static inline URMPortMask urmPinMask(byte pin) { return 1ul << g_APinDescription[pin].ulPin; }
+
+#elif defined(ARDUINO_ARCH_RP2040)
+	#include "hardware/structs/sio.h"
+
+	#define URM_FAST_GPIO_AVAILABLE
+	#define URM_PORT_HAS_SET_CLEAR
+
+	typedef volatile uint32_t URMPortRegister;
+	typedef uint32_t URMPortMask;
+
+	// All GPIOs are in the same bank of the single-cycle IO block. The Mbed-based core numbers
+	// the pins differently from the GPIOs.
+	static inline URMPortRegister* urmPinInputRegister(byte) { return (URMPortRegister*)&sio_hw->gpio_in; }
+	static inline URMPortRegister* urmPinOutputRegister(byte) { return (URMPortRegister*)&sio_hw->gpio_out; }
+	static inline URMPortRegister* urmPinSetRegister(byte) { return &sio_hw->gpio_set; }
+	static inline URMPortRegister* urmPinClearRegister(byte) { return &sio_hw->gpio_clr; }
+
+	#ifdef ARDUINO_ARCH_MBED
+		static inline URMPortMask urmPinMask(byte pin) { return 1ul << (uint32_t)digitalPinToPinName(pin); }
+	#else
+		static inline URMPortMask urmPinMask(byte pin) { return 1ul << pin; }
+	#endif
+
+#elif defined(ARDUINO_ARCH_ESP32)
+	#include "soc/gpio_reg.h"
+
+	#define URM_FAST_GPIO_AVAILABLE
+	#define URM_PORT_HAS_SET_CLEAR
+
+	typedef volatile uint32_t URMPortRegister;
+	typedef uint32_t URMPortMask;
+
+	// GPIOs 32 and above are in the second bank, which the smaller chips don't have.
+	#ifdef GPIO_IN1_REG
+		static inline URMPortRegister* urmPinInputRegister(byte pin) { return (URMPortRegister*)((pin < 32) ? GPIO_IN_REG : GPIO_IN1_REG); }
+		static inline URMPortRegister* urmPinOutputRegister(byte pin) { return (URMPortRegister*)((pin < 32) ? GPIO_OUT_REG : GPIO_OUT1_REG); }
+		static inline URMPortRegister* urmPinSetRegister(byte pin) { return (URMPortRegister*)((pin < 32) ? GPIO_OUT_W1TS_REG : GPIO_OUT1_W1TS_REG); }
+		static inline URMPortRegister* urmPinClearRegister(byte pin) { return (URMPortRegister*)((pin < 32) ? GPIO_OUT_W1TC_REG : GPIO_OUT1_W1TC_REG); }
+	#else
+		static inline URMPortRegister* urmPinInputRegister(byte) { return (URMPortRegister*)GPIO_IN_REG; }
+		static inline URMPortRegister* urmPinOutputRegister(byte) { return (URMPortRegister*)GPIO_OUT_REG; }
+		static inline URMPortRegister* urmPinSetRegister(byte) { return (URMPortRegister*)GPIO_OUT_W1TS_REG; }
+		static inline URMPortRegister* urmPinClearRegister(byte) { return (URMPortRegister*)GPIO_OUT_W1TC_REG; }
+	#endif
+
+	static inline URMPortMask urmPinMask(byte pin) { return 1ul << (pin & 31); }
+
+#elif defined(__AVR__) || defined(URM_HAL_HEADER)
+	// The HAL is expected to provide the same port macros as the AVR core does.
+	#define URM_FAST_GPIO_AVAILABLE
+
+	// Only the oldest AVRs can't toggle the pins through PINx (and the HAL can't either).
+	#if defined(__AVR__) && !defined(__AVR_ATmega8__) && !defined(__AVR_ATmega16__) && \
+		!defined(__AVR_ATmega32__) && !defined(__AVR_ATmega64__) && !defined(__AVR_ATmega128__) && \
+		!defined(__AVR_ATmega162__) && !defined(__AVR_ATmega8515__) && !defined(__AVR_ATmega8535__)
+		#define URM_PORT_HAS_TOGGLE
+	#endif
+
+	typedef volatile uint8_t URMPortRegister;
+	typedef uint8_t URMPortMask;
+
+	static inline URMPortRegister* urmPinInputRegister(byte pin) { return portInputRegister(digitalPinToPort(pin)); }
+	static inline URMPortRegister* urmPinOutputRegister(byte pin) { return portOutputRegister(digitalPinToPort(pin)); }
+
+	#ifdef URM_PORT_HAS_TOGGLE
+		static inline URMPortRegister* urmPinSetRegister(byte pin) { return portInputRegister(digitalPinToPort(pin)); }
+		static inline URMPortRegister* urmPinClearRegister(byte pin) { return portInputRegister(digitalPinToPort(pin)); }
+	#else
+		static inline URMPortRegister* urmPinSetRegister(byte pin) { return portOutputRegister(digitalPinToPort(pin)); }
+		static inline URMPortRegister* urmPinClearRegister(byte pin) { return portOutputRegister(digitalPinToPort(pin)); }
+	#endif
+	static inline URMPortMask urmPinMask(byte pin) { return digitalPinToBitMask(pin); }
+#endif
+
+#if defined(URM_USE_PORTS_DIRECTLY) && !defined(URM_FAST_GPIO_AVAILABLE)
+	#undef URM_USE_PORTS_DIRECTLY
+#endif
+
+#ifdef URM_FAST_GPIO_AVAILABLE
+/**
+ * Sets the pins of setMask to HIGH and the pins of clearMask to LOW, all of the same port,
+ * as close in time as possible (with a single write on AVR).
+ */
+static inline void urmWritePortBits(URMPortRegister* outputRegister, URMPortRegister* setRegister,
+	URMPortRegister* clearRegister, URMPortMask setMask, URMPortMask clearMask)
+{
+#if defined(URM_PORT_HAS_SET_CLEAR)
+	(void)outputRegister;
+	*setRegister = setMask;
+	*clearRegister = clearMask;
+#elif defined(URM_PORT_HAS_TOGGLE)
+	(void)clearRegister;
+	URMPortMask latch = *outputRegister;
+	*setRegister = (setMask & ~latch) | (clearMask & latch);
+#elif defined(__AVR__)
+	(void)setRegister;
+	(void)clearRegister;
+	uint8_t savedSREG = SREG;
+	cli();
+	*outputRegister = (*outputRegister | setMask) & ~clearMask;
+	SREG = savedSREG;
+#else
+	(void)setRegister;
+	(void)clearRegister;
+	*outputRegister = (*outputRegister | setMask) & ~clearMask;
+#endif
+}
+
+/**
+ * Sets the pins of the mask to HIGH.
+ */
+static inline void urmSetPortBits(URMPortRegister* outputRegister, URMPortRegister* setRegister, URMPortMask mask)
+{
+#if defined(URM_PORT_HAS_SET_CLEAR)
+	(void)outputRegister;
+	*setRegister = mask;
+#elif defined(URM_PORT_HAS_TOGGLE)
+	*setRegister = mask & ~*outputRegister;
+#else
+	urmWritePortBits(outputRegister, setRegister, setRegister, mask, 0);
+#endif
+}
+
+/**
+ * Sets the pins of the mask to LOW.
+ */
+static inline void urmClearPortBits(URMPortRegister* outputRegister, URMPortRegister* clearRegister, URMPortMask mask)
+{
+#if defined(URM_PORT_HAS_SET_CLEAR)
+	(void)outputRegister;
+	*clearRegister = mask;
+#elif defined(URM_PORT_HAS_TOGGLE)
+	*clearRegister = mask & *outputRegister;
+#else
+	urmWritePortBits(outputRegister, clearRegister, clearRegister, 0, mask);
+#endif
+}
+#endif
+
+#endif
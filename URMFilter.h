@@ -0,0 +1,162 @@
+#ifndef URMFILTER_H
+#define URMFILTER_H
+
+#include "URMHal.h"
+
+#ifndef URM_INVALID_VALUE
+	#define URM_INVALID_VALUE 0xFFFFFFFF // Same as in URMSensor.h
+#endif
+
+/**
+ * Maximal number of values the median is taken of.
+ */
+#define URM_FILTER_MAX_MEDIAN_SIZE 5
+
+/**
+ * Maximal weight shift of the moving average. The average keeps the values multiplied
+ * by 2^averageShift, so the pulses up to 16 s long fit into 32 bits.
+ */
+#define URM_FILTER_MAX_AVERAGE_SHIFT 8
+
+/**
+ * A filter removing occasional spikes (caused by multipath echoes or cross-talk between the sensors)
+ * from the measured values. It works in two stages, each of them can be turned off:
+ *
+ * - running median of the latest 3 or 5 values, which drops single spikes completely;
+ * - exponential moving average, which smooths the noise: every new value moves the result
+ *   by 1/2^averageShift of the difference.
+ *
+ * The result is updated every time a value is added, and takes only a few comparisons and
+ * shifts (the median is taken with a sorting network, without any loops), so it's cheap enough
+ * to be done in an interrupt handler. Reading the result takes no time at all.
+ *
+ * Pass the filter to URMSensor::setFilter() or URMSensorArray::setFilter(); every sensor needs
+ * its own instance.
+ *
+ * @author Andrey A. Vasenev
+ */
+class URMFilter
+{
+	public:
+		/**
+		 * Constructor.
+		 *
+		 * @param medianSize Number of the latest values the median is taken of: 3, 5, or 1 to turn
+		 * the median off.
+		 *
+		 * @param averageShift Weight of the new value in the moving average is 1/2^averageShift
+		 * (up to URM_FILTER_MAX_AVERAGE_SHIFT), or 0 to turn the average off.
+		 */
+		URMFilter(byte medianSize = 3, byte averageShift = 0)
+		{
+			_medianSize = (medianSize >= 5) ? 5 : ((medianSize >= 3) ? 3 : 1);
+			_averageShift = (averageShift > URM_FILTER_MAX_AVERAGE_SHIFT) ? URM_FILTER_MAX_AVERAGE_SHIFT : averageShift;
+
+			reset();
+		}
+
+		/**
+		 * Forgets all values added before. Call it when the old values are no longer relevant,
+		 * for example, after the sensor was turned to another direction.
+		 */
+		void reset()
+		{
+			_hasValue = false;
+			_value = URM_INVALID_VALUE;
+		}
+
+		/**
+		 * Adds the new value and updates the result.
+		 */
+		void add(unsigned long value)
+		{
+			// The first value fills the whole window, so the result is valid right away.
+			if (!_hasValue)
+			{
+				for (byte i = 0; i < URM_FILTER_MAX_MEDIAN_SIZE; i++) _window[i] = value;
+
+				_windowIndex = 0;
+				_averageSum = value << _averageShift;
+				_hasValue = true;
+				_value = value;
+				return;
+			}
+
+			if (_medianSize > 1)
+			{
+				_window[_windowIndex] = value;
+				if (++_windowIndex == _medianSize) _windowIndex = 0;
+
+				value = (_medianSize == 3) ? median3() : median5();
+			}
+
+			if (_averageShift > 0)
+			{
+				_averageSum = _averageSum - (_averageSum >> _averageShift) + value;
+				value = _averageSum >> _averageShift;
+			}
+
+			_value = value;
+		}
+
+		/**
+		 * Retrieves the filtered value.
+		 *
+		 * @return The filtered value, or URM_INVALID_VALUE if no value was added yet.
+		 */
+		unsigned long getValue()
+		{
+			return _value;
+		}
+
+	private:
+		byte _medianSize;
+		byte _averageShift;
+
+		boolean _hasValue;
+		unsigned long _value;
+
+		unsigned long _window[URM_FILTER_MAX_MEDIAN_SIZE];
+		byte _windowIndex;
+
+		unsigned long _averageSum;
+
+		static void sort(unsigned long& a, unsigned long& b)
+		{
+			if (a > b)
+			{
+				unsigned long t = a;
+				a = b;
+				b = t;
+			}
+		}
+
+		unsigned long median3()
+		{
+			unsigned long a = _window[0], b = _window[1], c = _window[2];
+
+			sort(a, b);
+			sort(b, c);
+			sort(a, b);
+
+			return b;
+		}
+
+		unsigned long median5()
+		{
+			unsigned long a = _window[0], b = _window[1], c = _window[2], d = _window[3], e = _window[4];
+
+			// 7 exchanges are enough to put the median in the middle without sorting the other values.
+			sort(a, b);
+			sort(d, e);
+			sort(a, d);
+			sort(b, e);
+			sort(b, c);
+			sort(c, d);
+			sort(b, c);
+
+			return c;
+		}
+};
+
+#endif
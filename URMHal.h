@@ -0,0 +1,20 @@
+#ifndef URMHAL_H
+#define URMHAL_H
+
+/**
+ * The only place the library takes the Arduino API from (micros(), digitalRead(), port registers,
+ * etc.). To build the library without the Arduino core, define URM_HAL_HEADER in the compiler
+ * flags as the name of the header providing the same API, for example:
+ *
+ *     -DURM_HAL_HEADER='"URMSimulatedHal.h"'
+ *
+ * extras/simulation contains such a header with the simulated clock and echoes, so the library
+ * can be run on a PC (see extras/simulation/README.md).
+ */
+#ifdef URM_HAL_HEADER
+	#include URM_HAL_HEADER
+#else
+	#include "Arduino.h"
+#endif
+
+#endif
@@ -0,0 +1,455 @@
+#ifndef URMPACKEDARRAY_H
+#define URMPACKEDARRAY_H
+
+#include "URMSensorT.h"
+#include "URMSensorArray.h"
+
+/**
+ * Pulse width URMPackedArray stores for the failed measures.
+ */
+#define URM_PACKED_INVALID_WIDTH 0xFFFF
+
+/**
+ * Bit mask type big enough for the given number of sensors.
+ */
+template <bool IsWide>
+struct URMPackedMask
+{
+	typedef uint8_t Type;
+};
+
+template <>
+struct URMPackedMask<true>
+{
+	typedef uint16_t Type;
+};
+
+/**
+ * A class that drives many sensors of the same kind with as little RAM as possible. It works just like
+ * URMSensorArray with groups (without its adaptive sampling, filters and events), but does not need
+ * URMSensor instances: the sensor constants come from the profile (see URMSensorT.h) and are not
+ * stored at all, and every sensor only takes its pins, its group and two 16-bit times (7 bytes,
+ * plus 4 bits of its status and a few bits of the masks the state is kept in). With
+ * URM_USE_PORTS_DIRECTLY, the port and the mask of every ECHO pin are looked up once, in addSensor(),
+ * so update() reads every port once and doesn't look anything up; that takes a few more bytes
+ * per sensor (4 on AVR).
+ *
+ * The times are the lower 16 bits of micros(), so the profile's timeouts must be shorter than 65 ms
+ * (they are for URM37 and HC-SR04), and update() must be called at least that often while
+ * the sensors measure.
+ *
+ * Example:
+ *     URMPackedArray<12, HC_SR04Profile> sensors;
+ *
+ *     void setup() { sensors.addSensor(2, 3, 0); sensors.addSensor(4, 5, 1); ... }
+ *     void loop() { sensors.update(); ... sensors.getDistance(0) ... }
+ *
+ * @author Andrey A. Vasenev
+ */
+template <byte MaxSensors, class Profile = HC_SR04Profile>
+class URMPackedArray
+{
+	static_assert((MaxSensors > 0) && (MaxSensors <= 16), "URMPackedArray can hold from 1 to 16 sensors");
+	static_assert((Profile::timeoutForPulseStart < 0xFFFF) && (Profile::maxPulseDuration < 0xFFFF),
+		"The timeouts of the profile don't fit in 16 bits");
+	static_assert(StatusRejected <= 0x0F, "URMPackedArray keeps the statuses in 4 bits");
+
+	public:
+		URMPackedArray()
+		{
+			_sensorCount = 0;
+
+			_currentGroup = 0;
+			_groupIsMeasuring = false;
+			_waitingMask = 0;
+			_pulseMask = 0;
+
+			_guardTime = URM_ARRAY_DEFAULT_GUARD_TIME;
+			_lastTriggerTime = 0;
+			_groupTriggerTime = 0;
+
+			for (byte slot = 0; slot < MaxSensors; slot++) _startTimes[slot] = 0;
+			for (byte i = 0; i < sizeof(_statuses); i++) _statuses[i] = 0;
+
+		#ifdef URM_USE_PORTS_DIRECTLY
+			_echoPortCount = 0;
+		#endif
+
+			_sweepCount = 0;
+		}
+
+		/**
+		 * Adds the sensor to the array and initializes its pins.
+		 *
+		 * @param trigPin Number of the Arduino pin connected to the TRIG pin on the sensor.
+		 *
+		 * @param echoPin Number of the Arduino pin connected to the ECHO/PWM pin on the sensor.
+		 *
+		 * @param group Number of the group the sensor will belong to.
+		 *
+		 * @return Number of the slot the sensor was put in, or URM_ARRAY_INVALID_SLOT if the array
+		 * is full.
+		 */
+		byte addSensor(byte trigPin, byte echoPin, byte group = 0)
+		{
+			if (_sensorCount == MaxSensors) return URM_ARRAY_INVALID_SLOT;
+
+			byte slot = _sensorCount;
+
+			_trigPins[slot] = trigPin;
+			_echoPins[slot] = echoPin;
+			_groups[slot] = group;
+			_widths[slot] = URM_PACKED_INVALID_WIDTH;
+			setStatus(slot, StatusNone);
+
+			writePin(trigPin, idleState(Profile::trigActiveState));
+			pinMode(trigPin, OUTPUT);
+			writePin(trigPin, idleState(Profile::trigActiveState));
+			pinMode(echoPin, INPUT);
+
+		#ifdef URM_USE_PORTS_DIRECTLY
+			URMPortRegister* echoPort = urmPinInputRegister(echoPin);
+
+			byte portIndex = 0;
+			while ((portIndex < _echoPortCount) && (_echoPorts[portIndex] != echoPort)) portIndex++;
+
+			if (portIndex == _echoPortCount) _echoPorts[_echoPortCount++] = echoPort;
+
+			_echoPortIndices[slot] = portIndex;
+			_echoMasks[slot] = urmPinMask(echoPin);
+		#endif
+
+			_sensorCount++;
+			return slot;
+		}
+
+		/**
+		 * Moves the sensor to another group. See URMSensorArray::setGroup().
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @param group Number of the new group.
+		 */
+		void setGroup(byte slot, byte group)
+		{
+			if (slot < _sensorCount) _groups[slot] = group;
+		}
+
+		/**
+		 * Sets the minimal time between triggering two consecutive groups. See URMSensorArray::setGuardTime().
+		 *
+		 * @param guardTime Time in microseconds.
+		 */
+		void setGuardTime(unsigned long guardTime)
+		{
+			_guardTime = guardTime;
+		}
+
+		/**
+		 * Retrieves the number of sensors in the array.
+		 */
+		byte getSensorCount()
+		{
+			return _sensorCount;
+		}
+
+		/**
+		 * Does the work: fires the next group when it's time to, and samples the ECHO pins of the group
+		 * being measured. Call this method from the loop() function as often as possible.
+		 */
+		void update()
+		{
+			if (_sensorCount == 0) return;
+
+			// Waiting for the current group to finish...
+			if (_groupIsMeasuring)
+			{
+				sampleGroup();
+				if ((_waitingMask | _pulseMask) != 0) return;
+
+				_groupIsMeasuring = false;
+				selectNextGroup();
+			}
+
+			// ...and for the echoes to fade away before firing the next one.
+			if (micros() - _lastTriggerTime < _guardTime) return;
+
+			startGroup();
+		}
+
+		/**
+		 * Retrieves the latest distance measured by the sensor.
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return Distance in centimeters, or URM_INVALID_VALUE if the latest measure failed
+		 * or there was no measure yet.
+		 */
+		unsigned long getDistance(byte slot)
+		{
+			if ((slot >= _sensorCount) || (_widths[slot] == URM_PACKED_INVALID_WIDTH)) return URM_INVALID_VALUE;
+
+			// The divisor is a constant, so the compiler can replace the division with multiplication.
+			return _widths[slot] / Profile::usPerCm;
+		}
+
+		/**
+		 * Retrieves the latest distance measured by the sensor, in millimeters.
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return Distance in millimeters, or URM_INVALID_VALUE if the latest measure failed
+		 * or there was no measure yet.
+		 */
+		unsigned long getDistanceMm(byte slot)
+		{
+			if ((slot >= _sensorCount) || (_widths[slot] == URM_PACKED_INVALID_WIDTH)) return URM_INVALID_VALUE;
+
+			return (unsigned long)_widths[slot] * 10 / Profile::usPerCm;
+		}
+
+		/**
+		 * Retrieves the result of the latest measure done by the sensor, so a timeout can be told from
+		 * the stuck ECHO pin. The value stays the same until the sensor finishes its next measure.
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return StatusOk, StatusEchoStuck, StatusNoEcho, StatusPulseTooLong, or StatusNone if
+		 * there was no measure yet.
+		 */
+		byte getStatus(byte slot)
+		{
+			if (slot >= _sensorCount) return StatusNone;
+
+			return (_statuses[slot >> 1] >> ((slot & 1) * 4)) & 0x0F;
+		}
+
+		/**
+		 * Retrieves the number of sweeps through all the groups done so far.
+		 */
+		unsigned long getSweepCount()
+		{
+			return _sweepCount;
+		}
+
+	private:
+		typedef typename URMPackedMask<(MaxSensors > 8)>::Type Mask;
+
+	#ifdef URM_USE_PORTS_DIRECTLY
+		typedef URMPortMask EchoSnapshots[MaxSensors];
+	#else
+		typedef byte EchoSnapshots[1];
+	#endif
+
+		byte _trigPins[MaxSensors];
+		byte _echoPins[MaxSensors];
+		byte _groups[MaxSensors];
+
+		// Time when the pulse started while measuring, in the lower 16 bits of micros().
+		uint16_t _startTimes[MaxSensors];
+
+		// Width of the latest pulse in microseconds.
+		uint16_t _widths[MaxSensors];
+
+		// Result of the latest measure (see URMStatus), two sensors per byte: the even slot
+		// in the lower 4 bits.
+		byte _statuses[(MaxSensors + 1) / 2];
+
+	#ifdef URM_USE_PORTS_DIRECTLY
+		// Input registers of the ports the ECHO pins are connected to, and the index of the port
+		// in _echoPorts with the mask of the pin for every slot.
+		URMPortRegister* _echoPorts[MaxSensors];
+		byte _echoPortCount;
+
+		byte _echoPortIndices[MaxSensors];
+		URMPortMask _echoMasks[MaxSensors];
+	#endif
+
+		// Sensors of the current group waiting for the pulse to start, and the ones measuring it.
+		Mask _waitingMask;
+		Mask _pulseMask;
+
+		byte _sensorCount;
+
+		byte _currentGroup;
+		boolean _groupIsMeasuring;
+
+		unsigned long _guardTime;
+		unsigned long _lastTriggerTime;
+
+		// Time when the trigger pulse of the current group ended, in the lower 16 bits of micros().
+		uint16_t _groupTriggerTime;
+
+		unsigned long _sweepCount;
+
+		static byte idleState(byte activeState)
+		{
+			return (activeState == HIGH) ? LOW : HIGH;
+		}
+
+		void setStatus(byte slot, byte status)
+		{
+			byte shift = (slot & 1) * 4;
+			_statuses[slot >> 1] = (_statuses[slot >> 1] & ~(0x0F << shift)) | (status << shift);
+		}
+
+		/**
+		 * Finishes the measure of the sensor with the given width (or URM_PACKED_INVALID_WIDTH)
+		 * and status.
+		 */
+		void completeMeasure(byte slot, uint16_t width, byte status)
+		{
+			_widths[slot] = width;
+			setStatus(slot, status);
+		}
+
+	#ifdef URM_USE_PORTS_DIRECTLY
+		/**
+		 * Reads every port of the ECHO pins once, so all the sensors are sampled at the same time.
+		 */
+		void readEchoPorts(URMPortMask* snapshots)
+		{
+			for (byte portIndex = 0; portIndex < _echoPortCount; portIndex++) snapshots[portIndex] = *_echoPorts[portIndex];
+		}
+
+		byte readEcho(const URMPortMask* snapshots, byte slot)
+		{
+			return ((snapshots[_echoPortIndices[slot]] & _echoMasks[slot]) != 0) ? HIGH : LOW;
+		}
+	#else
+		// Without the direct port access the pins are read one by one, and there's nothing to cache.
+		void readEchoPorts(byte*)
+		{
+		}
+
+		byte readEcho(const byte*, byte slot)
+		{
+			return digitalRead(_echoPins[slot]);
+		}
+	#endif
+
+		// The TRIG registers are looked up by the pin number every time: it's done once per measure,
+		// and they don't take RAM.
+		static void writePin(byte pin, byte value)
+		{
+		#ifdef URM_USE_PORTS_DIRECTLY
+			if (value == HIGH)
+				urmSetPortBits(urmPinOutputRegister(pin), urmPinSetRegister(pin), urmPinMask(pin));
+			else
+				urmClearPortBits(urmPinOutputRegister(pin), urmPinClearRegister(pin), urmPinMask(pin));
+		#else
+			digitalWrite(pin, value);
+		#endif
+		}
+
+		/**
+		 * Fires all sensors of the current group at once.
+		 */
+		void startGroup()
+		{
+			EchoSnapshots snapshots;
+			readEchoPorts(snapshots);
+
+			// The sensors whose ECHO pin is stuck fail right away.
+			Mask group = 0;
+			for (byte slot = 0; slot < _sensorCount; slot++)
+			{
+				if (_groups[slot] != _currentGroup) continue;
+
+				if (readEcho(snapshots, slot) == Profile::echoActiveState) completeMeasure(slot, URM_PACKED_INVALID_WIDTH, StatusEchoStuck);
+				else group |= (Mask)1 << slot;
+			}
+
+			// The group could become empty after setGroup() call, so we'll try the next one right away:
+			// the guard time only starts when something is fired.
+			if (group == 0)
+			{
+				selectNextGroup();
+				return;
+			}
+
+			_lastTriggerTime = micros();
+
+			for (byte slot = 0; slot < _sensorCount; slot++)
+			{
+				if (group & ((Mask)1 << slot)) writePin(_trigPins[slot], Profile::trigActiveState);
+			}
+
+			delayMicroseconds(Profile::trigPulseWidth);
+
+			for (byte slot = 0; slot < _sensorCount; slot++)
+			{
+				if (group & ((Mask)1 << slot)) writePin(_trigPins[slot], idleState(Profile::trigActiveState));
+			}
+
+			_groupTriggerTime = (uint16_t)micros();
+			_waitingMask = group;
+			_pulseMask = 0;
+			_groupIsMeasuring = true;
+		}
+
+		/**
+		 * Samples the ECHO pins of the sensors still measuring, all with the same timestamp.
+		 */
+		void sampleGroup()
+		{
+			EchoSnapshots snapshots;
+			readEchoPorts(snapshots);
+
+			uint16_t now = (uint16_t)micros();
+			uint16_t sinceTrigger = now - _groupTriggerTime;
+
+			Mask active = _waitingMask | _pulseMask;
+
+			for (byte slot = 0; active != 0; slot++, active >>= 1)
+			{
+				if (!(active & 1)) continue;
+
+				Mask bit = (Mask)1 << slot;
+				boolean echoIsActive = (readEcho(snapshots, slot) == Profile::echoActiveState);
+
+				if (_waitingMask & bit)
+				{
+					if (echoIsActive)
+					{
+						_waitingMask &= ~bit;
+						_pulseMask |= bit;
+						_startTimes[slot] = now;
+					}
+					else if (sinceTrigger > Profile::timeoutForPulseStart)
+					{
+						_waitingMask &= ~bit;
+						completeMeasure(slot, URM_PACKED_INVALID_WIDTH, StatusNoEcho);
+					}
+				}
+				else
+				{
+					uint16_t width = now - _startTimes[slot];
+
+					if (!echoIsActive)
+					{
+						_pulseMask &= ~bit;
+						completeMeasure(slot, width, StatusOk);
+					}
+					else if (width > Profile::maxPulseDuration)
+					{
+						_pulseMask &= ~bit;
+						completeMeasure(slot, URM_PACKED_INVALID_WIDTH, StatusPulseTooLong);
+					}
+				}
+			}
+		}
+
+		/**
+		 * Switches to the group with the next number, or to the first one after the last group.
+		 */
+		void selectNextGroup()
+		{
+			byte nextGroup = urmSelectNextGroup(_groups, _sensorCount, _currentGroup);
+			if (nextGroup <= _currentGroup) _sweepCount++;
+
+			_currentGroup = nextGroup;
+		}
+};
+
+#endif
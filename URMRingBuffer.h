@@ -0,0 +1,126 @@
+#ifndef URMRINGBUFFER_H
+#define URMRINGBUFFER_H
+
+#include "URMHal.h"
+
+/**
+ * Keeps the compiler from moving memory accesses across this point. The ring buffer needs it
+ * to write the item before publishing the new head (and to read it before releasing the slot).
+ */
+#define URM_MEMORY_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/**
+ * Fixed-size queue for exactly one producer (usually an interrupt handler) and exactly one
+ * consumer (usually the loop() function). Neither side has to disable interrupts: each of them
+ * only writes its own index, and the indices are single bytes, so they are read and written
+ * at once even on 8-bit boards.
+ *
+ * One item is always kept free to tell the full buffer from the empty one, so the buffer can hold
+ * up to (Size - 1) items.
+ *
+ * @param T Type of the items.
+ *
+ * @param Size Number of items, must be a power of 2 not greater than 128.
+ *
+ * @author Andrey A. Vasenev
+ */
+template <class T, byte Size>
+class URMRingBuffer
+{
+	static_assert((Size >= 2) && (Size <= 128) && ((Size & (Size - 1)) == 0),
+		"Size of URMRingBuffer must be a power of 2 between 2 and 128");
+
+	public:
+		/**
+		 * Constructor.
+		 */
+		URMRingBuffer()
+		{
+			_head = 0;
+			_tail = 0;
+			_droppedCount = 0;
+		}
+
+		/**
+		 * Adds the item to the buffer. Must be called by the producer only.
+		 *
+		 * @return true if the item was added, or false if the buffer is full.
+		 */
+		boolean push(const T& item)
+		{
+			byte head = _head;
+			byte nextHead = (head + 1) & (Size - 1);
+
+			if (nextHead == _tail)
+			{
+				_droppedCount++;
+				return false;
+			}
+
+			_items[head] = item;
+
+			URM_MEMORY_BARRIER();
+			_head = nextHead;
+			return true;
+		}
+
+		/**
+		 * Takes the oldest item from the buffer. Must be called by the consumer only.
+		 *
+		 * @return true if the item was taken, or false if the buffer is empty.
+		 */
+		boolean pop(T& item)
+		{
+			return (pop(&item, 1) == 1);
+		}
+
+		/**
+		 * Takes up to maxCount oldest items from the buffer at once. Must be called by the consumer only.
+		 *
+		 * @return Number of items taken.
+		 */
+		byte pop(T* items, byte maxCount)
+		{
+			byte tail = _tail;
+			byte head = _head;
+			URM_MEMORY_BARRIER();
+
+			byte count = 0;
+			while ((tail != head) && (count < maxCount))
+			{
+				items[count++] = _items[tail];
+				tail = (tail + 1) & (Size - 1);
+			}
+
+			URM_MEMORY_BARRIER();
+			_tail = tail;
+			return count;
+		}
+
+		/**
+		 * Retrieves the number of items in the buffer.
+		 */
+		byte getCount()
+		{
+			return (_head - _tail) & (Size - 1);
+		}
+
+		/**
+		 * Retrieves the number of items that didn't fit into the buffer. The counter wraps around
+		 * after 255.
+		 */
+		byte getDroppedCount()
+		{
+			return _droppedCount;
+		}
+
+	private:
+		T _items[Size];
+
+		volatile byte _head;
+		volatile byte _tail;
+
+		volatile byte _droppedCount;
+};
+
+#endif
@@ -1,84 +1,370 @@
 #include "URMSensor.h"
 
+// Critical sections are only needed when the state can be changed by the interrupt handlers.
+#if (defined(URM_USE_INTERRUPTS) || defined(URM_USE_TIMER1)) && defined(__AVR__)
+	#define URM_ATOMIC_BEGIN { uint8_t urmSavedSREG = SREG; cli();
+	#define URM_ATOMIC_END SREG = urmSavedSREG; }
+#elif defined(URM_USE_INTERRUPTS) || defined(URM_USE_TIMER1)
+	#define URM_ATOMIC_BEGIN { noInterrupts();
+	#define URM_ATOMIC_END interrupts(); }
+#else
+	#define URM_ATOMIC_BEGIN {
+	#define URM_ATOMIC_END }
+#endif
+
+#ifdef URM_USE_SLEEP
+
+#ifndef __AVR__
+	#error URM_USE_SLEEP is only supported for AVR boards
+#endif
+
+#if !defined(URM_USE_INTERRUPTS) && !defined(URM_USE_INPUT_CAPTURE)
+	#error URM_USE_SLEEP needs URM_USE_INTERRUPTS or URM_USE_INPUT_CAPTURE
+#endif
+
+#include <avr/sleep.h>
+
+/**
+ * Sleeps till the next interrupt. Must be called with interrupts disabled: the instruction after
+ * sei() is always executed before any pending interrupt, so the interrupt that came after the caller
+ * checked the state wakes the core up right away instead of being handled before it falls asleep.
+ */
+static void urmSleepWithInterruptsDisabled()
+{
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
+
+void URMSensor::sleepUntilInterrupt()
+{
+	cli();
+	urmSleepWithInterruptsDisabled();
+}
+
+#endif
+
+#ifdef URM_USE_TICK_TIMING
+static void urmStartTimer1();
+#endif
+
 void URMSensor::startMeasure()
 {
-	// Ignoring the call if this instance already started measuring the distance.
-	if (_currentState == WaitingForPulse || _currentState == Measuring) return;
+	_cycleStartTime = micros();
 	
-	// Failing the measure if this instance is not attached to the sensor, or the ECHO pin
-	// is not in IDLE state.
-	if (!isAttached() || 
-		(fastDigitalReadEcho() == _echoActiveState))
+	if (!prepareMeasure()) return;
+
+#ifdef URM_USE_PIO
+	// The state machine makes the trigger pulse by itself.
+	if (_echoMode == EchoPio)
 	{
-		_currentState = Idle;
+		beginMeasure();
+		return;
+	}
+#endif
+
+#ifdef URM_USE_TIMED_TRIGGER
+	// The echo can't start before the end of the trigger pulse, so we can start waiting for it
+	// right now and let the timer finish the pulse.
+	if (startTimedTrigger())
+	{
+		beginMeasure();
 		return;
 	}
+#endif
 
 	// Starting the measure.
-	_currentState = WaitingForPulse;
-	
 	fastDigitalWriteTrig(_trigActiveState);
 	delayMicroseconds(_trigPulseWidth);
 	fastDigitalWriteTrig(getOppositeStateFor(_trigActiveState));
 	
-	resetTime();
-	refreshState();
+	beginMeasure();
 }
 
-boolean URMSensor::isMeasuring()
+boolean URMSensor::prepareMeasure()
 {
-	return (_currentState == WaitingForPulse || _currentState == Measuring);
+	// Ignoring the call if this instance already started measuring the distance.
+	if (_currentState == WaitingForPulse || _currentState == Measuring) return false;
+	
+	// Failing the measure if this instance is not attached to the sensor, or the ECHO pin
+	// is not in IDLE state.
+	if (!isAttached())
+	{
+		completeMeasure(Idle, StatusNotAttached);
+		return false;
+	}
+	
+	if (fastDigitalReadEcho() == _echoActiveState)
+	{
+		completeMeasure(Idle, StatusEchoStuck);
+		return false;
+	}
+	
+	// The speed of sound might have changed since the previous measure.
+	if ((_maxRange != 0) && (_environment != NULL)) updateMaxRangeDuration();
+	
+#ifdef URM_USE_TICK_TIMING
+	// The measure is timed by Timer1, so it must be running before the trigger pulse.
+	urmStartTimer1();
+#endif
+	
+	return true;
+}
+
+void URMSensor::updateMaxRangeDuration()
+{
+	URMTime duration;
+	
+	if (_maxRange == 0) duration = URM_TIME_MAX;
+	else if (_environment != NULL) duration = urmUsToTime(((unsigned long)_maxRange << 16) / _environment->getCmPerUsQ16());
+	else duration = urmUsToTime((unsigned long)_maxRange * _usPerCm);
+	
+	// The limit may be changed while the interrupt handler is measuring.
+	URM_ATOMIC_BEGIN
+	_maxRangeDuration = duration;
+	URM_ATOMIC_END
+}
+
+void URMSensor::beginMeasure()
+{
+	// The time must be reset before switching the state, otherwise an interrupt handler
+	// could compare the new state against the old time.
+	URM_ATOMIC_BEGIN
+	resetTime();
+	_currentState = WaitingForPulse;
+	_status = StatusMeasuring;
+	
+#ifdef URM_MAX_ECHOES
+	_echoCount = 0;
+	_isListeningForEchoes = false;
+#endif
+	
+#ifdef URM_USE_INSTRUMENTATION
+	_measureCount++;
+	_currentPollCount = 0;
+	_lastPollTime = _startMeasureTime;
+#endif
+	
+#ifdef URM_USE_INPUT_CAPTURE
+	if (_echoMode == EchoInputCapture)
+	{
+		// Waiting for the edge that starts the pulse. Changing the edge may set the flag,
+		// so we're clearing it after that.
+		if (_echoActiveState == HIGH) TCCR1B |= _BV(ICES1);
+		else TCCR1B &= ~_BV(ICES1);
+		
+		TIFR1 = _BV(ICF1);
+		TIMSK1 |= _BV(ICIE1);
+	}
+#endif
+
+#ifdef URM_USE_PIO
+	if (_echoMode == EchoPio) startPioMeasure();
+#endif
+	URM_ATOMIC_END
+	
+	refreshState();
 }
 
 void URMSensor::interruptMeasure()
 {
+	URM_ATOMIC_BEGIN
+	if (isMeasuring()) _status = StatusInterrupted;
 	_currentState = Idle;
+	URM_ATOMIC_END
 }
 
 void URMSensor::refreshState()
 {
-	byte echoState = fastDigitalReadEcho();
+	// In interrupt mode the edges are already handled by the interrupt handler, so here we
+	// will mostly detect timeouts. It's still safe to process the edges here too - we just
+	// must not let the interrupt handler run in the middle of it.
+	URM_ATOMIC_BEGIN
+	URMTime now = urmNow();
+	
+#ifdef URM_USE_INSTRUMENTATION
+	if (isMeasuring()) recordPoll(now);
+#endif
+	
+#ifdef URM_USE_PIO
+	if (_echoMode == EchoPio) readPioResults(now);
+#endif
+	
+#if defined(URM_USE_INPUT_CAPTURE) || defined(URM_USE_PIO)
+	// The hardware catches the edges much better, so we're only checking the timeouts here.
+	// Otherwise we could see the edge before its capture gets handled.
+	if ((_echoMode == EchoInputCapture) || (_echoMode == EchoPio))
+	{
+		updateState((_currentState == Measuring) ? _echoActiveState : getOppositeStateFor(_echoActiveState), now);
+	}
+	else
+#endif
+	updateState(fastDigitalReadEcho(), now);
+	URM_ATOMIC_END
+	
+	// In continuous mode the next measure is started as soon as the sensor is ready for it.
+	if (_isMeasuringContinuously && !isMeasuring() && (micros() - _cycleStartTime >= _minCycleTime))
+	{
+		startMeasure();
+	}
+}
+
+void URMSensor::completeMeasure(byte newState, byte status)
+{
+	_currentState = newState;
+	_status = status;
+	
+	if (status >= StatusNotAttached)
+	{
+		// Only the statuses the counters are kept for: StatusRejected and later ones are not counted.
+		byte index = status - StatusNotAttached;
+		if (index < URM_FAILURE_STATUS_COUNT) _failureCounts[index]++;
+		
+		if (_consecutiveFailureCount < 0xFF) _consecutiveFailureCount++;
+	}
+	else
+	{
+		_consecutiveFailureCount = 0;
+	}
+	
+#ifdef URM_USE_INSTRUMENTATION
+	if ((status == StatusNoEcho) || (status == StatusPulseTooLong)) _timeoutCount++;
+#endif
+	
+	_latestDuration = (newState == FinishedMeasure) ? urmTimeToUs(_currentDuration) : URM_INVALID_VALUE;
+	
+	if ((status == StatusOk) && (_filter != NULL)) _filter->add(_latestDuration);
+	
+#ifdef URM_MAX_ECHOES
+	// The later echoes can only be caught in the modes that see every edge.
+	_echoCount = 0;
+	_isListeningForEchoes = false;
+	
+	if (status == StatusOk)
+	{
+		_echoDurations[0] = _latestDuration;
+		_echoCount = 1;
+		
+		_isListeningForEchoes = (_echoMode == EchoPolling) || (_echoMode == EchoExternalInterrupt) ||
+			(_echoMode == EchoPinChange);
+		_listenedEchoState = getOppositeStateFor(_echoActiveState);
+	}
+#endif
+	_latestStatus = status;
+	_sequenceNumber++;
+	
+	if (_measurementHandler != NULL)
+	{
+		URMCompletion completion;
+		completion.duration = _latestDuration;
+		completion.status = status;
+		
+		_completions.push(completion);
+	}
+	
+#ifdef URM_SAMPLE_BUFFER_SIZE
+	URMSample sample;
+#ifdef URM_USE_TICK_TIMING
+	// The samples are timed by micros(), so the start of the pulse is converted once per measure.
+	sample.timestamp = micros() - urmTimeToUs(urmElapsed(urmNow(), _startMeasureTime));
+#else
+	sample.timestamp = _startMeasureTime;
+#endif
+	sample.pulseWidth = _latestDuration;
+	sample.status = status;
+	
+	_samples.push(sample);
+#endif
+}
 
+void URMSensor::updateState(byte echoState, URMTime now)
+{
 	switch (_currentState)
 	{
 		case WaitingForPulse:
-			if ((getCurrentDuration() > _timeoutForPulseStart) &&
+			if ((getCurrentDuration(now) > _timeoutForPulseStart) &&
 				(echoState != _echoActiveState))
 			{
-				_currentState = Idle;
+				completeMeasure(Idle, StatusNoEcho);
 			}
 			else if (echoState == _echoActiveState)
 			{
 				_currentState = Measuring;
-				resetTime();
+				_currentDuration = 0;
+				_startMeasureTime = now;
 			}
 			break;
 			
 		case Measuring:
-			if ((getCurrentDuration() > _maxPulseDuration) &&
+			if ((getCurrentDuration(now) > _maxPulseDuration) &&
 				(echoState == _echoActiveState))
 			{
-				_currentState = Idle;
+				completeMeasure(Idle, StatusPulseTooLong);
 			}
 			else if (echoState != _echoActiveState)
 			{
-				_currentState = FinishedMeasure;
+				completeMeasure(FinishedMeasure, StatusOk);
+			}
+			else if (_currentDuration > _maxRangeDuration)
+			{
+				completeMeasure(OutOfRange, StatusOutOfRange);
 			}
 			break;
 			
 		case FinishedMeasure:
+		#ifdef URM_MAX_ECHOES
+			if (_isListeningForEchoes) listenForEchoes(echoState, now);
+		#endif
+			break;
+			
+		case OutOfRange:
 		case Idle:
 		default:
 			break;
 	}
 }
 
+#ifdef URM_MAX_ECHOES
+
+#if URM_MAX_ECHOES < 2
+	#error URM_MAX_ECHOES must be at least 2
+#endif
+
+void URMSensor::listenForEchoes(byte echoState, URMTime now)
+{
+	// _currentDuration keeps the first echo for getMeasuredDistance(), so the time is counted
+	// separately. The sensor can't report the targets farther than its pulse can be long.
+	URMTime elapsed = urmElapsed(now, _startMeasureTime);
+	URMTime window = (_maxRangeDuration < _maxPulseDuration) ? _maxRangeDuration : _maxPulseDuration;
+	
+	if (elapsed > window)
+	{
+		_isListeningForEchoes = false;
+		return;
+	}
+	
+	if ((_listenedEchoState == _echoActiveState) && (echoState != _echoActiveState))
+	{
+		_echoDurations[_echoCount] = urmTimeToUs(elapsed);
+		_echoCount++;
+		
+		if (_echoCount == URM_MAX_ECHOES) _isListeningForEchoes = false;
+	}
+	
+	_listenedEchoState = echoState;
+}
+
+#endif
+
 boolean URMSensor::finishedMeasure()
 {
 	// If this instance haven't been attach()'d, reporting failure.
 	if (!_isAttached) 
 	{
 		_currentState = Idle;
+		_status = StatusNotAttached;
 		return true;
 	}
 
@@ -96,7 +382,217 @@ unsigned long URMSensor::getMeasuredDistance()
 	return convertCurrentDurationToDistance();
 }
 
+void URMSensor::startContinuousMeasure(unsigned long minCycleTime)
+{
+	_minCycleTime = minCycleTime;
+	_isMeasuringContinuously = true;
+	
+	startMeasure();
+}
+
+void URMSensor::stopContinuousMeasure()
+{
+	_isMeasuringContinuously = false;
+}
+
+unsigned long URMSensor::getLatestDistance()
+{
+	unsigned long duration;
+	
+	URM_ATOMIC_BEGIN
+	duration = _latestDuration;
+	URM_ATOMIC_END
+	
+	if (duration == URM_INVALID_VALUE) return URM_INVALID_VALUE;
+	
+	return convertDurationToDistance(duration);
+}
+
+unsigned long URMSensor::getFilteredDuration()
+{
+	if (_filter == NULL) return URM_INVALID_VALUE;
+	
+	unsigned long duration;
+	
+	URM_ATOMIC_BEGIN
+	duration = _filter->getValue();
+	URM_ATOMIC_END
+	
+	return duration;
+}
+
+unsigned long URMSensor::getFilteredDistance()
+{
+	unsigned long duration = getFilteredDuration();
+	if (duration == URM_INVALID_VALUE) return URM_INVALID_VALUE;
+	
+	return convertDurationToDistance(duration);
+}
+
+unsigned long URMSensor::getFilteredDistanceMm()
+{
+	unsigned long duration = getFilteredDuration();
+	if (duration == URM_INVALID_VALUE) return URM_INVALID_VALUE;
+	
+	return convertDurationToMm(duration);
+}
+
+unsigned int URMSensor::getFailureCount(byte status)
+{
+	if ((status < StatusNotAttached) || (status - StatusNotAttached >= URM_FAILURE_STATUS_COUNT)) return 0;
+	
+	unsigned int count;
+	
+	URM_ATOMIC_BEGIN
+	count = _failureCounts[status - StatusNotAttached];
+	URM_ATOMIC_END
+	
+	return count;
+}
+
+void URMSensor::resetFailureCounts()
+{
+	URM_ATOMIC_BEGIN
+	for (byte i = 0; i < URM_FAILURE_STATUS_COUNT; i++) _failureCounts[i] = 0;
+	_consecutiveFailureCount = 0;
+	URM_ATOMIC_END
+}
+
+#ifdef URM_USE_INSTRUMENTATION
+
+void URMSensor::recordPoll(URMTime now)
+{
+	unsigned long gap = urmTimeToUs(urmElapsed(now, _lastPollTime));
+	_lastPollTime = now;
+	
+	_pollGapSum += gap;
+	if (gap > _maxPollGap) _maxPollGap = gap;
+	
+	_pollCount++;
+	_currentPollCount++;
+	if (_currentPollCount > _maxPollsPerMeasure) _maxPollsPerMeasure = _currentPollCount;
+}
+
+void URMSensor::recordInterrupt(URMTime start)
+{
+	// The same time base as the start, so with URM_USE_TICK_TIMING the time is counted in ticks.
+	unsigned long time = urmTimeToUs(urmElapsed(urmNow(), start));
+	
+	_interruptCount++;
+	_interruptTimeSum += time;
+	if (time > _maxInterruptTime) _maxInterruptTime = time;
+}
+
+void URMSensor::getStatistics(URMStatistics& statistics)
+{
+	unsigned long pollGapSum;
+	unsigned long interruptTimeSum;
+	
+	URM_ATOMIC_BEGIN
+	statistics.measureCount = _measureCount;
+	statistics.pollCount = _pollCount;
+	statistics.maxPollsPerMeasure = _maxPollsPerMeasure;
+	statistics.maxPollGap = _maxPollGap;
+	statistics.interruptCount = _interruptCount;
+	statistics.maxInterruptTime = _maxInterruptTime;
+	statistics.timeoutCount = _timeoutCount;
+	pollGapSum = _pollGapSum;
+	interruptTimeSum = _interruptTimeSum;
+	URM_ATOMIC_END
+	
+	// The averages are computed here, so the counters themselves cost no divisions.
+	statistics.averagePollsPerMeasure = (statistics.measureCount != 0) ? 
+		(statistics.pollCount / statistics.measureCount) : 0;
+	statistics.averagePollGap = (statistics.pollCount != 0) ? (pollGapSum / statistics.pollCount) : 0;
+	statistics.averageInterruptTime = (statistics.interruptCount != 0) ? 
+		(interruptTimeSum / statistics.interruptCount) : 0;
+}
+
+void URMSensor::resetStatistics()
+{
+	URM_ATOMIC_BEGIN
+	_measureCount = 0;
+	_pollCount = 0;
+	_currentPollCount = 0;
+	_maxPollsPerMeasure = 0;
+	_lastPollTime = 0;
+	_pollGapSum = 0;
+	_maxPollGap = 0;
+	_interruptCount = 0;
+	_interruptTimeSum = 0;
+	_maxInterruptTime = 0;
+	_timeoutCount = 0;
+	URM_ATOMIC_END
+}
+
+void URMSensor::dumpStatistics(Print& output)
+{
+	URMStatistics statistics;
+	getStatistics(statistics);
+	
+	output.print("Measures: ");
+	output.print(statistics.measureCount);
+	output.print(", timeouts: ");
+	output.println(statistics.timeoutCount);
+	
+	output.print("Polls: ");
+	output.print(statistics.pollCount);
+	output.print(", per measure avg/max: ");
+	output.print(statistics.averagePollsPerMeasure);
+	output.print("/");
+	output.println(statistics.maxPollsPerMeasure);
+	
+	output.print("Poll gap avg/max, us: ");
+	output.print(statistics.averagePollGap);
+	output.print("/");
+	output.println(statistics.maxPollGap);
+	
+	output.print("Interrupts: ");
+	output.print(statistics.interruptCount);
+	output.print(", time avg/max, us: ");
+	output.print(statistics.averageInterruptTime);
+	output.print("/");
+	output.println(statistics.maxInterruptTime);
+}
+
+#endif
+
+unsigned int URMSensor::getSequenceNumber()
+{
+	unsigned int sequenceNumber;
+	
+	URM_ATOMIC_BEGIN
+	sequenceNumber = _sequenceNumber;
+	URM_ATOMIC_END
+	
+	return sequenceNumber;
+}
+
+
+
+void URMSensor::onMeasurementComplete(URMMeasurementHandler handler, byte id)
+{
+	_measurementHandler = handler;
+	_handlerId = id;
+	
+	// The measures finished before are not passed to the new handler.
+	URMCompletion completion;
+	while (_completions.pop(completion)) ;
+}
 
+void URMSensor::dispatch()
+{
+	refreshState();
+	
+	// The handler may be changed by the handler itself, so it is taken again for every measure.
+	URMCompletion completion;
+	while ((_measurementHandler != NULL) && _completions.pop(completion))
+	{
+		unsigned long distance = (completion.duration == URM_INVALID_VALUE) ? URM_INVALID_VALUE : 
+			convertDurationToDistance(completion.duration);
+		_measurementHandler(_handlerId, distance, completion.status);
+	}
+}
 
 /**
  * Synchronously gets the distance in front of the sensor. Maximal working time for 
@@ -107,12 +603,737 @@ unsigned long URMSensor::getMeasuredDistance()
  * @return Distance in front of the sensor in centimeters, or URM_INVALID_VALUE
  * in case of failure.
  */
-unsigned long URMSensor::measureDistance()
+unsigned long URMSensor::measureDistance(URMYieldHandler yieldHandler)
 {
 	startMeasure();
 	
-	while (!finishedMeasure()) ;
+#ifdef URM_USE_SLEEP
+	// In polling mode nobody would wake us up on the edge, so only the interrupt-driven modes sleep.
+	if ((_echoMode == EchoExternalInterrupt) || (_echoMode == EchoPinChange) || (_echoMode == EchoInputCapture))
+	{
+		while (true)
+		{
+			// The state is checked with interrupts disabled, so the edge that comes right after
+			// the check still wakes us up (see urmSleepWithInterruptsDisabled()).
+			cli();
+			if (finishedMeasure()) break;
+			
+			urmSleepWithInterruptsDisabled();
+			if (yieldHandler != NULL) yieldHandler();
+		}
+		
+		sei();
+		return getMeasuredDistance();
+	}
+#endif
+	
+	while (!finishedMeasure())
+	{
+		if (yieldHandler != NULL) yieldHandler();
+	}
 	
 	return getMeasuredDistance();
 }
+
+
+
+#ifdef URM_USE_INTERRUPTS
+
+URMSensor* volatile URMSensor::_interruptSensors[URM_MAX_INTERRUPT_SENSORS];
+URMSensor* volatile URMSensor::_pinChangeSensors[URM_MAX_INTERRUPT_SENSORS];
+volatile byte URMSensor::_pinChangeSensorCount;
+
+#if URM_MAX_INTERRUPT_SENSORS > 8
+	#error URM_MAX_INTERRUPT_SENSORS must not be greater than 8
+#endif
+
+void urmDispatchExternalInterrupt(byte slot)
+{
+	URMSensor* sensor = URMSensor::_interruptSensors[slot];
+	if (sensor == NULL) return;
+	
+	URMTime now = urmNow();
+	sensor->handleEchoInterrupt(sensor->fastDigitalReadEcho(), now);
+}
+
+void urmDispatchPinChange(byte bank)
+{
+	// All sensors in the bank share the same timestamp, since we can't tell which pin
+	// caused the interrupt anyway.
+	URMTime now = urmNow();
+	
+#ifdef URM_USE_PORTS_DIRECTLY
+	// The pins of a bank are normally on the same port, so it is read once, and all the sensors
+	// see the same sample of it. Another port is only read when some sensor is on it.
+	URMPortRegister* port = NULL;
+	URMPortMask snapshot = 0;
+#endif
+	
+	// Only the sensors whose ECHO pin has changed go through the state machine: for the others
+	// the handler just tests the pin.
+	byte count = URMSensor::_pinChangeSensorCount;
+	for (byte i = 0; i < count; i++)
+	{
+		URMSensor* sensor = URMSensor::_pinChangeSensors[i];
+		if (sensor->_pcintBank != bank) continue;
 		
+	#ifdef URM_USE_PORTS_DIRECTLY
+		if (sensor->_echoIN != port)
+		{
+			port = sensor->_echoIN;
+			snapshot = *port;
+		}
+		byte echoState = ((snapshot & sensor->_echoMask) != 0) ? HIGH : LOW;
+	#else
+		byte echoState = sensor->fastDigitalReadEcho();
+	#endif
+		if (echoState == sensor->_pinChangeEchoState) continue;
+		
+		sensor->_pinChangeEchoState = echoState;
+		sensor->handleEchoInterrupt(echoState, now);
+	}
+}
+
+// attachInterrupt() accepts only functions without arguments, so we need separate function
+// for every slot.
+template <byte slot>
+static void urmExternalInterruptHandler()
+{
+	urmDispatchExternalInterrupt(slot);
+}
+
+static void (* const urmExternalInterruptHandlers[8])() = 
+{
+	urmExternalInterruptHandler<0>, urmExternalInterruptHandler<1>,
+	urmExternalInterruptHandler<2>, urmExternalInterruptHandler<3>,
+	urmExternalInterruptHandler<4>, urmExternalInterruptHandler<5>,
+	urmExternalInterruptHandler<6>, urmExternalInterruptHandler<7>
+};
+
+#if defined(__AVR__) && defined(digitalPinToPCICR)
+	#ifdef PCINT0_vect
+		ISR(PCINT0_vect) { urmDispatchPinChange(0); }
+	#endif
+	
+	#ifdef PCINT1_vect
+		ISR(PCINT1_vect) { urmDispatchPinChange(1); }
+	#endif
+	
+	#ifdef PCINT2_vect
+		ISR(PCINT2_vect) { urmDispatchPinChange(2); }
+	#endif
+	
+	#ifdef PCINT3_vect
+		ISR(PCINT3_vect) { urmDispatchPinChange(3); }
+	#endif
+#endif
+
+boolean URMSensor::attachInterruptMode()
+{
+	if (!_isAttached) return false;
+	if ((_echoMode == EchoExternalInterrupt) || (_echoMode == EchoPinChange)) return true;
+	if (_echoMode != EchoPolling) return false;
+	
+	// Looking for a free slot.
+	byte slot = 0;
+	while ((slot < URM_MAX_INTERRUPT_SENSORS) && (_interruptSensors[slot] != NULL)) slot++;
+	
+	if (slot == URM_MAX_INTERRUPT_SENSORS) return false;
+	
+	_interruptSlot = slot;
+	
+	// External interrupts are preferred - they don't have to share the handler with other pins.
+	int interruptNumber = digitalPinToInterrupt(_echoPin);
+	if (interruptNumber != NOT_AN_INTERRUPT)
+	{
+		_echoMode = EchoExternalInterrupt;
+		_interruptSensors[slot] = this;
+		
+		attachInterrupt(interruptNumber, urmExternalInterruptHandlers[slot], CHANGE);
+		return true;
+	}
+	
+#if defined(__AVR__) && defined(digitalPinToPCICR)
+	volatile uint8_t* pcicr = digitalPinToPCICR(_echoPin);
+	if (pcicr != NULL)
+	{
+		_pcintBank = digitalPinToPCICRbit(_echoPin);
+		_pinChangeEchoState = fastDigitalReadEcho();
+		
+		URM_ATOMIC_BEGIN
+		_echoMode = EchoPinChange;
+		_interruptSensors[slot] = this;
+		_pinChangeSensors[_pinChangeSensorCount++] = this;
+		URM_ATOMIC_END
+		
+		*digitalPinToPCMSK(_echoPin) |= _BV(digitalPinToPCMSKbit(_echoPin));
+		*pcicr |= _BV(_pcintBank);
+		return true;
+	}
+#endif
+	
+	return false;
+}
+
+void URMSensor::detachInterruptMode()
+{
+	if (_echoMode == EchoExternalInterrupt)
+	{
+		detachInterrupt(digitalPinToInterrupt(_echoPin));
+	}
+#if defined(__AVR__) && defined(digitalPinToPCICR)
+	else if (_echoMode == EchoPinChange)
+	{
+		// The bank itself is left enabled, since other pins of it may still be in use.
+		*digitalPinToPCMSK(_echoPin) &= ~_BV(digitalPinToPCMSKbit(_echoPin));
+	}
+#endif
+	else
+	{
+		return;
+	}
+	
+	URM_ATOMIC_BEGIN
+	// The last sensor of the list takes the place of this one.
+	if (_echoMode == EchoPinChange)
+	{
+		byte i = 0;
+		while (_pinChangeSensors[i] != this) i++;
+		
+		_pinChangeSensors[i] = _pinChangeSensors[--_pinChangeSensorCount];
+	}
+	
+	_interruptSensors[_interruptSlot] = NULL;
+	_echoMode = EchoPolling;
+	URM_ATOMIC_END
+}
+
+#endif
+
+
+
+#ifdef URM_USE_TIMER1
+
+#ifndef __AVR__
+	#error URM_USE_INPUT_CAPTURE, URM_USE_TIMED_TRIGGER and URM_USE_TICK_TIMING are only supported for AVR boards
+#endif
+
+#if URM_TIMER1_PRESCALER == 1
+	#define URM_TIMER1_CLOCK_SELECT (_BV(CS10))
+#elif URM_TIMER1_PRESCALER == 8
+	#define URM_TIMER1_CLOCK_SELECT (_BV(CS11))
+#elif URM_TIMER1_PRESCALER == 64
+	#define URM_TIMER1_CLOCK_SELECT (_BV(CS11) | _BV(CS10))
+#elif URM_TIMER1_PRESCALER == 256
+	#define URM_TIMER1_CLOCK_SELECT (_BV(CS12))
+#elif URM_TIMER1_PRESCALER == 1024
+	#define URM_TIMER1_CLOCK_SELECT (_BV(CS12) | _BV(CS10))
+#else
+	#error URM_TIMER1_PRESCALER must be 1, 8, 64, 256 or 1024
+#endif
+
+// Timer1 is only 16-bit, so we're counting its overflows to measure pulses longer than one period.
+static volatile unsigned int urmTimer1Overflows;
+static boolean urmTimer1Started = false;
+
+static void urmStartTimer1()
+{
+	if (urmTimer1Started) return;
+	
+	URM_ATOMIC_BEGIN
+	// Normal mode with the noise canceler on. The canceler delays both edges by 4 clock 
+	// cycles, so it does not affect the pulse width.
+	TCCR1A = 0;
+	TCCR1B = _BV(ICNC1) | URM_TIMER1_CLOCK_SELECT;
+	TCNT1 = 0;
+	
+	urmTimer1Overflows = 0;
+	TIFR1 = _BV(TOV1) | _BV(ICF1) | _BV(OCF1A) | _BV(OCF1B);
+	TIMSK1 = _BV(TOIE1);
+	URM_ATOMIC_END
+	
+	urmTimer1Started = true;
+}
+
+ISR(TIMER1_OVF_vect)
+{
+	urmTimer1Overflows++;
+}
+
+#endif
+
+
+
+#ifdef URM_USE_INPUT_CAPTURE
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__) || \
+	defined(__AVR_ATmega88__) || defined(__AVR_ATmega48__)
+	#define URM_ICP1_PIN 8
+#elif defined(__AVR_ATmega32U4__)
+	#define URM_ICP1_PIN 4
+#else
+	#error URM_USE_INPUT_CAPTURE is not supported for this board
+#endif
+
+URMSensor* volatile URMSensor::_inputCaptureSensor;
+
+/**
+ * Extends the captured value of Timer1 to 32 bits. Must be called with interrupts disabled.
+ */
+static unsigned long urmExtendTimer1(unsigned int value)
+{
+	unsigned int overflows = urmTimer1Overflows;
+	
+	// The timer might have overflown after the value was captured, but before its overflow
+	// was handled. Small value means that the capture happened after the overflow.
+	if ((TIFR1 & _BV(TOV1)) && (value < 0x8000)) overflows++;
+	
+	return ((unsigned long)overflows << 16) | value;
+}
+
+static unsigned long urmTimer1TicksToUs(unsigned long ticks)
+{
+	return (ticks * URM_TIMER1_PRESCALER) / (F_CPU / 1000000UL);
+}
+
+void urmDispatchInputCapture(unsigned int capture)
+{
+	URMSensor* sensor = URMSensor::_inputCaptureSensor;
+	if (sensor != NULL) sensor->handleInputCapture(urmExtendTimer1(capture));
+}
+
+ISR(TIMER1_CAPT_vect)
+{
+	urmDispatchInputCapture(ICR1);
+}
+
+void URMSensor::handleInputCapture(unsigned long ticks)
+{
+#ifdef URM_USE_INSTRUMENTATION
+	URMTime start = urmNow();
+#endif
+	
+	switch (_currentState)
+	{
+		case WaitingForPulse:
+			_captureTicks = ticks;
+			_currentDuration = 0;
+			_startMeasureTime = urmNow();
+			_currentState = Measuring;
+			
+			// Now waiting for the opposite edge.
+			TCCR1B ^= _BV(ICES1);
+			TIFR1 = _BV(ICF1);
+			break;
+			
+		case Measuring:
+			_captureTicks = ticks - _captureTicks;
+			_currentDuration = urmUsToTime(urmTimer1TicksToUs(_captureTicks));
+			completeMeasure(FinishedMeasure, StatusOk);
+			
+			TIMSK1 &= ~_BV(ICIE1);
+			break;
+			
+		case FinishedMeasure:
+		case OutOfRange:
+		case Idle:
+		default:
+			// The measure was interrupted or timed out.
+			TIMSK1 &= ~_BV(ICIE1);
+			break;
+	}
+	
+#ifdef URM_USE_INSTRUMENTATION
+	recordInterrupt(start);
+#endif
+}
+
+boolean URMSensor::attachInputCaptureMode()
+{
+	if (!_isAttached || (_echoPin != URM_ICP1_PIN)) return false;
+	if (_echoMode == EchoInputCapture) return true;
+	if ((_echoMode != EchoPolling) || (_inputCaptureSensor != NULL)) return false;
+	
+	urmStartTimer1();
+	
+	URM_ATOMIC_BEGIN
+	_inputCaptureSensor = this;
+	_echoMode = EchoInputCapture;
+	URM_ATOMIC_END
+	
+	return true;
+}
+
+void URMSensor::detachInputCaptureMode()
+{
+	if (_echoMode != EchoInputCapture) return;
+	
+	URM_ATOMIC_BEGIN
+	TIMSK1 &= ~_BV(ICIE1);
+	_inputCaptureSensor = NULL;
+	_echoMode = EchoPolling;
+	URM_ATOMIC_END
+}
+
+unsigned long URMSensor::getPulseWidthTicks()
+{
+	if ((_currentState != FinishedMeasure) || (_echoMode != EchoInputCapture)) return URM_INVALID_VALUE;
+	
+	return _captureTicks;
+}
+
+#endif
+
+
+
+#ifdef URM_USE_TIMED_TRIGGER
+
+// The pulse can be up to two ticks longer than requested (see startTimedTrigger()), so the ticks
+// must be short enough for the shortest pulse done by the timer.
+#if URM_TIMER1_PRESCALER > URM_TIMED_TRIGGER_MIN_WIDTH * (F_CPU / 1000000UL)
+	#error URM_USE_TIMED_TRIGGER needs Timer1 ticks not longer than URM_TIMED_TRIGGER_MIN_WIDTH, lower URM_TIMER1_PRESCALER
+#endif
+
+// Pins driven by the output compare units of Timer1.
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__) || \
+	defined(__AVR_ATmega88__) || defined(__AVR_ATmega48__) || defined(__AVR_ATmega32U4__)
+	#define URM_OC1A_PIN 9
+	#define URM_OC1B_PIN 10
+#elif defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+	#define URM_OC1A_PIN 11
+	#define URM_OC1B_PIN 12
+#else
+	#define URM_OC1A_PIN 0xFF
+	#define URM_OC1B_PIN 0xFF
+#endif
+
+// Sensors whose trigger pulses are being finished by compare units A and B of Timer1.
+static URMSensor* volatile urmTriggerChannels[2];
+
+static const byte urmCompareInterruptMasks[2] = { _BV(OCIE1A), _BV(OCIE1B) };
+static const byte urmCompareFlagMasks[2] = { _BV(OCF1A), _BV(OCF1B) };
+
+void urmDispatchTriggerCompare(byte channel)
+{
+	URMSensor* sensor = urmTriggerChannels[channel];
+	
+	// If the TRIG pin is connected to the compare unit output, the pulse was already finished 
+	// by the hardware.
+	if ((sensor != NULL) && !sensor->isTrigCompareOutput(channel))
+	{
+		sensor->fastDigitalWriteTrig(sensor->getOppositeStateFor(sensor->_trigActiveState));
+	}
+	
+	urmTriggerChannels[channel] = NULL;
+	TIMSK1 &= ~urmCompareInterruptMasks[channel];
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+	urmDispatchTriggerCompare(0);
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+	urmDispatchTriggerCompare(1);
+}
+
+boolean URMSensor::isTrigCompareOutput(byte channel)
+{
+	return (_trigPin == ((channel == 0) ? URM_OC1A_PIN : URM_OC1B_PIN));
+}
+
+/**
+ * Connects or disconnects the TRIG pin to the output of the compare unit. When connected,
+ * the pin will be set to the given state on the compare match.
+ */
+static void urmSetCompareOutputMode(byte channel, boolean connected, byte stateOnMatch)
+{
+	byte mode = 0;
+	if (connected) mode = (stateOnMatch == HIGH) ? (_BV(COM1A1) | _BV(COM1A0)) : _BV(COM1A1);
+	
+	// COM1Bx bits are the same as COM1Ax ones, just shifted by 2.
+	if (channel == 0) TCCR1A = (TCCR1A & ~(_BV(COM1A1) | _BV(COM1A0))) | mode;
+	else TCCR1A = (TCCR1A & ~(_BV(COM1B1) | _BV(COM1B0))) | (mode >> 2);
+}
+
+boolean URMSensor::startTimedTrigger()
+{
+	// Short pulses are cheaper to do by hand than to schedule.
+	if (_trigPulseWidth < URM_TIMED_TRIGGER_MIN_WIDTH) return false;
+	
+	urmStartTimer1();
+	
+	// Rounded up, plus one tick: the pulse starts somewhere within the current tick, so it lasts
+	// between (pulseTicks - 1) and pulseTicks full ticks, and must never be shorter than requested.
+	unsigned int pulseTicks = ((unsigned long)_trigPulseWidth * (F_CPU / 1000000UL) + URM_TIMER1_PRESCALER - 1) /
+		URM_TIMER1_PRESCALER + 1;
+	
+	boolean started = false;
+	
+	URM_ATOMIC_BEGIN
+	// If the TRIG pin is the output of some compare unit, only that unit can be used.
+	byte channel = 0;
+	while ((channel < 2) && (urmTriggerChannels[channel] != NULL || 
+		isTrigCompareOutput(1 - channel))) channel++;
+	
+	if (channel < 2)
+	{
+		byte idleState = getOppositeStateFor(_trigActiveState);
+		
+		urmTriggerChannels[channel] = this;
+		
+		if (isTrigCompareOutput(channel))
+		{
+			// The port keeps the idle state in case the pin is disconnected from the compare unit
+			// later. The pulse is started by forcing the compare match and finished by the real one.
+			fastDigitalWriteTrig(idleState);
+			
+			urmSetCompareOutputMode(channel, true, _trigActiveState);
+			TCCR1C = (channel == 0) ? _BV(FOC1A) : _BV(FOC1B);
+			urmSetCompareOutputMode(channel, true, idleState);
+		}
+		else
+		{
+			fastDigitalWriteTrig(_trigActiveState);
+		}
+		
+		if (channel == 0) OCR1A = TCNT1 + pulseTicks;
+		else OCR1B = TCNT1 + pulseTicks;
+		
+		TIFR1 = urmCompareFlagMasks[channel];
+		TIMSK1 |= urmCompareInterruptMasks[channel];
+		
+		started = true;
+	}
+	else
+	{
+		// The pulse will be done by hand, so the pin must be controlled by the port.
+		if (isTrigCompareOutput(0)) urmSetCompareOutputMode(0, false, LOW);
+		if (isTrigCompareOutput(1)) urmSetCompareOutputMode(1, false, LOW);
+	}
+	URM_ATOMIC_END
+	
+	return started;
+}
+
+#endif
+
+
+
+#ifdef URM_USE_PIO
+
+#ifndef ARDUINO_ARCH_RP2040
+	#error URM_USE_PIO is only supported for RP2040 boards
+#endif
+
+#include "hardware/clocks.h"
+
+// The Mbed-based core numbers the pins differently from the GPIOs.
+#ifdef ARDUINO_ARCH_MBED
+	#define URM_PIN_TO_GPIO(pin) ((uint)digitalPinToPinName(pin))
+#else
+	#define URM_PIN_TO_GPIO(pin) ((uint)(pin))
+#endif
+
+#define URM_PIO_BLOCK_COUNT 2
+#define URM_PIO_MAX_PROGRAM_LENGTH 13
+#define URM_PIO_NOT_LOADED 0xFF
+
+// The program depends on the active state of the ECHO pin only (the active state of the TRIG pin
+// is made by the output inversion of its GPIO), so there are up to two programs in every block.
+static byte urmPioProgramOffsets[URM_PIO_BLOCK_COUNT][2] = 
+{
+	{ URM_PIO_NOT_LOADED, URM_PIO_NOT_LOADED },
+	{ URM_PIO_NOT_LOADED, URM_PIO_NOT_LOADED }
+};
+
+/**
+ * Builds the program measuring the pulse of the given active state, with the addresses relative
+ * to its start (pio_add_program() relocates them).
+ *
+ * The state machine waits for the trigger pulse width (in clock cycles) in its TX FIFO, makes
+ * the pulse and waits for the echo. It sends a word to the RX FIFO when the echo starts, and
+ * the pulse width in 2-cycle loops when it ends. The timeouts are detected by refreshState(),
+ * and the state machine is restarted before every measure.
+ */
+static byte urmBuildPioProgram(uint16_t* program, byte echoActiveState)
+{
+	byte length = 0;
+	
+	program[length++] = pio_encode_pull(false, true);
+	program[length++] = pio_encode_out(pio_x, 32);
+	program[length++] = pio_encode_set(pio_pins, 1);
+	program[length] = pio_encode_jmp_x_dec(length); length++;
+	program[length++] = pio_encode_set(pio_pins, 0);
+	program[length++] = pio_encode_wait_pin(echoActiveState == HIGH, 0);
+	program[length++] = pio_encode_push(false, false);
+	program[length++] = pio_encode_mov_not(pio_x, pio_null);
+	
+	// Counting down while the ECHO pin stays active: JMP PIN only jumps to the HIGH state,
+	// so the HIGH pulse needs one more jump (it doesn't make the loop longer).
+	byte loop = length;
+	if (echoActiveState == HIGH)
+	{
+		program[length++] = pio_encode_jmp_pin(loop + 2);
+		program[length++] = pio_encode_jmp(loop + 3);
+		program[length++] = pio_encode_jmp_x_dec(loop);
+	}
+	else
+	{
+		program[length++] = pio_encode_jmp_pin(loop + 2);
+		program[length++] = pio_encode_jmp_x_dec(loop);
+	}
+	
+	program[length++] = pio_encode_mov_not(pio_isr, pio_x);
+	program[length++] = pio_encode_push(false, false);
+	
+	return length;
+}
+
+/**
+ * Loads the program for the given ECHO active state into the block, if it's not there yet.
+ *
+ * @return Offset of the program, or URM_PIO_NOT_LOADED if there's no room for it.
+ */
+static byte urmLoadPioProgram(byte blockIndex, PIO pio, byte echoActiveState, byte& length)
+{
+	uint16_t instructions[URM_PIO_MAX_PROGRAM_LENGTH];
+	length = urmBuildPioProgram(instructions, echoActiveState);
+	
+	byte& offset = urmPioProgramOffsets[blockIndex][(echoActiveState == HIGH) ? 1 : 0];
+	if (offset != URM_PIO_NOT_LOADED) return offset;
+	
+	// Newer versions of the SDK have more fields in the structure, so they are zeroed first.
+	pio_program_t program = {};
+	program.instructions = instructions;
+	program.length = length;
+	program.origin = -1;
+	
+	if (!pio_can_add_program(pio, &program)) return URM_PIO_NOT_LOADED;
+	
+	offset = pio_add_program(pio, &program);
+	return offset;
+}
+
+boolean URMSensor::attachPioMode()
+{
+	if (!_isAttached) return false;
+	if (_echoMode == EchoPio) return true;
+	if (_echoMode != EchoPolling) return false;
+	
+	// Looking for a block with a free state machine and room for the program.
+	PIO blocks[URM_PIO_BLOCK_COUNT] = { pio0, pio1 };
+	
+	for (byte blockIndex = 0; blockIndex < URM_PIO_BLOCK_COUNT; blockIndex++)
+	{
+		PIO pio = blocks[blockIndex];
+		
+		int stateMachine = pio_claim_unused_sm(pio, false);
+		if (stateMachine < 0) continue;
+		
+		byte length;
+		byte offset = urmLoadPioProgram(blockIndex, pio, _echoActiveState, length);
+		if (offset == URM_PIO_NOT_LOADED)
+		{
+			pio_sm_unclaim(pio, stateMachine);
+			continue;
+		}
+		
+		uint trigGpio = URM_PIN_TO_GPIO(_trigPin);
+		uint echoGpio = URM_PIN_TO_GPIO(_echoPin);
+		
+		pio_sm_config config = pio_get_default_sm_config();
+		sm_config_set_wrap(&config, offset, offset + length - 1);
+		sm_config_set_set_pins(&config, trigGpio, 1);
+		sm_config_set_in_pins(&config, echoGpio);
+		sm_config_set_jmp_pin(&config, echoGpio);
+		pio_sm_init(pio, stateMachine, offset, &config);
+		
+		// The TRIG pin is given to the state machine in its idle state. The ECHO pin is only read,
+		// so it stays with the SIO, and prepareMeasure() can still check it.
+		pio_sm_set_pins_with_mask(pio, stateMachine, 0, 1u << trigGpio);
+		pio_sm_set_consecutive_pindirs(pio, stateMachine, trigGpio, 1, true);
+		pio_gpio_init(pio, trigGpio);
+		
+		// Selecting the function resets the overrides, so the inversion goes after it.
+		gpio_set_outover(trigGpio, (_trigActiveState == HIGH) ? GPIO_OVERRIDE_NORMAL : GPIO_OVERRIDE_INVERT);
+		
+		_pio = pio;
+		_pioStateMachine = stateMachine;
+		_pioProgramOffset = offset;
+		_echoMode = EchoPio;
+		
+		return true;
+	}
+	
+	return false;
+}
+
+void URMSensor::detachPioMode()
+{
+	if (_echoMode != EchoPio) return;
+	
+	pio_sm_set_enabled(_pio, _pioStateMachine, false);
+	pio_sm_unclaim(_pio, _pioStateMachine);
+	
+	// The program stays loaded for the next sensors.
+	interruptMeasure();
+	_echoMode = EchoPolling;
+	
+	// Giving the TRIG pin back to the SIO.
+	gpio_set_outover(URM_PIN_TO_GPIO(_trigPin), GPIO_OVERRIDE_NORMAL);
+	setTrigMode(OUTPUT);
+	fastDigitalWriteTrig(getOppositeStateFor(_trigActiveState));
+}
+
+void URMSensor::startPioMeasure()
+{
+	PIO pio = _pio;
+	uint stateMachine = _pioStateMachine;
+	
+	// Whatever the state machine was doing (it may still wait for the echo of the measure that
+	// timed out), it starts from the beginning with the TRIG pin idle and the FIFOs empty.
+	pio_sm_set_enabled(pio, stateMachine, false);
+	pio_sm_clear_fifos(pio, stateMachine);
+	pio_sm_restart(pio, stateMachine);
+	pio_sm_exec(pio, stateMachine, pio_encode_set(pio_pins, 0));
+	pio_sm_exec(pio, stateMachine, pio_encode_jmp(_pioProgramOffset));
+	
+	uint32_t cyclesPerUs = clock_get_hz(clk_sys) / 1000000;
+	pio_sm_put(pio, stateMachine, _trigPulseWidth * cyclesPerUs - 1);
+	
+	pio_sm_set_enabled(pio, stateMachine, true);
+}
+
+void URMSensor::readPioResults(URMTime now)
+{
+	while (!pio_sm_is_rx_fifo_empty(_pio, _pioStateMachine))
+	{
+		uint32_t value = pio_sm_get(_pio, _pioStateMachine);
+		
+		switch (_currentState)
+		{
+			case WaitingForPulse:
+				// The pulse has started: only its timeouts are measured with micros().
+				_currentDuration = 0;
+				_startMeasureTime = now;
+				_currentState = Measuring;
+				break;
+				
+			case Measuring:
+				_currentDuration = urmUsToTime((value * 2) / (clock_get_hz(clk_sys) / 1000000));
+				completeMeasure(FinishedMeasure, StatusOk);
+				break;
+				
+			case FinishedMeasure:
+			case OutOfRange:
+			case Idle:
+			default:
+				// Nothing is expected after the end of the measure.
+				break;
+		}
+	}
+}
+
+#endif
@@ -1,7 +1,10 @@
 #ifndef URMSENSOR_H
 #define URMSENSOR_H
 
-#include "Arduino.h"
+#include "URMHal.h"
+#include "URMRingBuffer.h"
+#include "URMEnvironment.h"
+#include "URMFilter.h"
 
 /**
  * Value that marks invalid result of the measure. Receiving this value as the measurement result
@@ -14,11 +17,120 @@
 /**
  * Unlocks direct work with port registers instead of digitalRead() and digitalWrite().
  * This will make refreshState() and finishedMeasure() to work a bit faster (for about 5-10 us), 
- * but the URMSensor class will consume more RAM (about 12 bytes per instance), and the code 
- * will no more be compatible with Arduino Due.
+ * but the URMSensor class will consume more RAM (about 10 bytes per instance on AVR, 24 bytes on
+ * 32-bit boards). It works on AVR, SAM (Arduino Due), SAMD, RP2040 and ESP32 boards, and is
+ * turned off automatically on other ones (see URMFastGpio.h).
  */
 #define URM_USE_PORTS_DIRECTLY
 
+/**
+ * Unlocks interrupt-driven echo capture (see URMSensor::attachInterruptMode()). When it is enabled
+ * on AVR boards, the library defines its own handlers for PCINTx_vect interrupt vectors, so it
+ * will conflict with other libraries doing the same (for example, SoftwareSerial).
+ */
+// #define URM_USE_INTERRUPTS
+
+/**
+ * Maximal number of sensors that can work in interrupt mode at the same time (up to 8).
+ */
+#define URM_MAX_INTERRUPT_SENSORS 8
+
+/**
+ * Unlocks hardware input capture of the echo (see URMSensor::attachInputCaptureMode()). The library
+ * takes over Timer1 for it, so analogWrite() on Timer1 pins (9 and 10 on Arduino Uno) and other 
+ * libraries using Timer1 (Servo, TimerOne, etc.) will no longer work.
+ */
+// #define URM_USE_INPUT_CAPTURE
+
+/**
+ * Prescaler for Timer1 when it is used by the library (1, 8, 64, 256 or 1024). The default value
+ * gives the resolution of 62.5 ns on 16 MHz boards.
+ */
+#define URM_TIMER1_PRESCALER 1
+
+/**
+ * Makes startMeasure() not wait for the end of the trigger pulse (see URMSensor::startMeasure()).
+ * The pulse is finished by the compare match interrupt of Timer1, so this takes over Timer1 just like 
+ * URM_USE_INPUT_CAPTURE does. If the TRIG pin is the output of the compare unit (pins 9 and 10 on
+ * Arduino Uno), the pulse is finished by the hardware itself.
+ */
+// #define URM_USE_TIMED_TRIGGER
+
+/**
+ * Trigger pulses shorter than this value (in us) are always done by startMeasure() itself.
+ */
+#define URM_TIMED_TRIGGER_MIN_WIDTH 4 // us
+
+/**
+ * Makes the instances of URMSensor time the measures with the 16-bit counter of Timer1 instead of
+ * micros() (see URMTime.h): every refresh gets a few microseconds shorter on AVR, and the times of
+ * the measure take half the RAM. This takes over Timer1 just like URM_USE_INPUT_CAPTURE does, and
+ * URM_TIMER1_PRESCALER must be set to give whole microseconds per tick and the timer period longer
+ * than the timeouts: 64 on 16 MHz boards gives 4 us per tick (0.07 cm) and 262 ms. With
+ * URM_USE_TIMED_TRIGGER the tick must also be no longer than URM_TIMED_TRIGGER_MIN_WIDTH (use 8
+ * on 8 MHz boards). While measuring, the state must be refreshed at least once per timer period.
+ * AVR only.
+ */
+// #define URM_USE_TICK_TIMING
+
+/**
+ * Makes measureDistance() put the board to IDLE sleep while it waits for the sensor in the interrupt
+ * and input capture modes (see URMSensor::sleepUntilInterrupt()), instead of spinning the core.
+ * The timers keep running in IDLE mode, so micros() and the measures stay accurate. AVR only.
+ */
+// #define URM_USE_SLEEP
+
+/**
+ * Unlocks the PIO measure engine on RP2040 boards (see URMSensor::attachPioMode()). Every sensor
+ * in this mode takes one PIO state machine (there are 8 of them), and the program of up to
+ * 13 instructions is loaded into the instruction memory of the PIO block.
+ */
+// #define URM_USE_PIO
+
+/**
+ * Unlocks buffering of the measure results (see URMSensor::readSamples()). Every instance of URMSensor
+ * gets the ring buffer for the given number of samples (must be a power of 2), so the results produced
+ * by interrupt handlers or in continuous mode will not be lost if loop() is slow. Every sample takes 
+ * 9 bytes of RAM.
+ */
+// #define URM_SAMPLE_BUFFER_SIZE 8
+
+/**
+ * Number of finished measures every instance of URMSensor keeps for its dispatch() (must be a power of 2,
+ * and one entry is always kept free). Each measure is passed to the handler set by onMeasurementComplete()
+ * once, even if it was finished by refreshState() called outside dispatch(); the measures that don't fit
+ * are lost (see getDroppedDispatchCount()). Every entry takes 5 bytes of RAM.
+ */
+#define URM_DISPATCH_QUEUE_SIZE 4
+
+/**
+ * Makes every instance of URMSensor collect the statistics of its work (see URMSensor::getStatistics()):
+ * how often its state is refreshed during the measure, how long its interrupt handlers take, and how
+ * many measures time out. Use it to tune your loop() function, and turn it off after that: it takes
+ * about 45 bytes of RAM per instance and a few microseconds per refresh.
+ */
+// #define URM_USE_INSTRUMENTATION
+
+/**
+ * Unlocks capture of several echoes per measure (see URMSensor::getEchoCount()). The measure is still
+ * finished by the end of the first echo pulse, but after that the instance keeps listening to the ECHO
+ * pin for up to the given number of echoes in total, so the modules reporting several targets give
+ * them all from a single ping. Every echo takes 4 bytes of RAM per instance.
+ */
+// #define URM_MAX_ECHOES 4
+
+// Timer1 is taken over by the library if any of the features above needs it.
+#if defined(URM_USE_INPUT_CAPTURE) || defined(URM_USE_TIMED_TRIGGER) || defined(URM_USE_TICK_TIMING)
+	#define URM_USE_TIMER1
+#endif
+
+#include "URMFastGpio.h"
+#include "URMTime.h"
+
+#ifdef URM_USE_PIO
+	#include "hardware/pio.h"
+#endif
+
 
 /**
  * Constant used to convert pulse width from DFRobot URM37 sensor (in PWM mode) to range.
@@ -79,8 +191,218 @@ enum URMState
 	 * The library did successfully measure the distance. The finishedMeasure() method 
 	 * will return true and measured distance in this state.
 	 */
-	FinishedMeasure
+	FinishedMeasure,
+	
+	/**
+	 * The library gave up the measure because the pulse got longer than the maximal range set by 
+	 * setMaxRange(), so there's no target within that range. The finishedMeasure() method will 
+	 * return true and URM_INVALID_VALUE in this state.
+	 */
+	OutOfRange
+};
+
+/**
+ * Results of the measure. Unlike URMState, they tell why the measure failed. You can use it 
+ * to interpret the getStatus() return value.
+ */
+enum URMStatus
+{
+	/**
+	 * No measure was done yet.
+	 */
+	StatusNone,
+	
+	/**
+	 * The measure is in progress.
+	 */
+	StatusMeasuring,
+	
+	/**
+	 * The distance was measured successfully.
+	 */
+	StatusOk,
+	
+	/**
+	 * The measure was interrupted by interruptMeasure() call.
+	 */
+	StatusInterrupted,
+	
+	// All statuses below are failures, and they are counted by getFailureCount().
+	
+	/**
+	 * The instance is not attached to the sensor.
+	 */
+	StatusNotAttached,
+	
+	/**
+	 * The ECHO line was already active when the measure had to start. Usually the sensor is still
+	 * busy with the previous measure, so it's worth retrying soon.
+	 */
+	StatusEchoStuck,
+	
+	/**
+	 * The sensor did not respond in time (timeoutForPulseStart). Usually it means that the sensor 
+	 * is disconnected or broken.
+	 */
+	StatusNoEcho,
+	
+	/**
+	 * The pulse was longer than maxPulseDuration.
+	 */
+	StatusPulseTooLong,
+	
+	/**
+	 * There's no target within the range set by setMaxRange().
+	 */
+	StatusOutOfRange,
+	
+	/**
+	 * The echo came earlier than the target could get there since the previous measure, so it
+	 * probably came from another sensor. Only URMSensorArray reports this status (see 
+	 * URMSensorArray::setCrossTalkRejection()), and it is not counted by getFailureCount().
+	 */
+	StatusRejected
+};
+
+/**
+ * Number of failure statuses, from StatusNotAttached to StatusOutOfRange.
+ */
+#define URM_FAILURE_STATUS_COUNT 5
+
+static_assert(URM_FAILURE_STATUS_COUNT == StatusOutOfRange - StatusNotAttached + 1,
+	"URM_FAILURE_STATUS_COUNT must match the failure statuses of URMStatus");
+
+/**
+ * Possible ways of catching the edges of the ECHO pulse. You can use it to interpret
+ * the getEchoMode() return value.
+ */
+enum URMEchoMode
+{
+	/**
+	 * The edges are caught by refreshState(), so their timestamps are only as precise
+	 * as often this method is called.
+	 */
+	EchoPolling,
+	
+	/**
+	 * The edges are caught by external interrupt (INTx) handler of the ECHO pin.
+	 */
+	EchoExternalInterrupt,
+	
+	/**
+	 * The edges are caught by pin change interrupt (PCINTx) handler of the ECHO pin's bank.
+	 */
+	EchoPinChange,
+	
+	/**
+	 * The edges are latched by the input capture unit of Timer1 (ICP1 pin).
+	 */
+	EchoInputCapture,
+	
+	/**
+	 * The trigger pulse is made and the echo pulse is measured by the PIO state machine (RP2040).
+	 */
+	EchoPio
+};
+
+/**
+ * Result of a single measure, as stored in the sample buffer (see URM_SAMPLE_BUFFER_SIZE).
+ */
+struct URMSample
+{
+	/**
+	 * Time when the pulse started (or when the measure started if there was no pulse), as returned
+	 * by micros().
+	 */
+	unsigned long timestamp;
+	
+	/**
+	 * Width of the pulse in microseconds, or URM_INVALID_VALUE if the measure failed.
+	 */
+	unsigned long pulseWidth;
+	
+	/**
+	 * Result of the measure (see URMStatus).
+	 */
+	byte status;
+};
+
+/**
+ * Finished measure waiting for URMSensor::dispatch().
+ */
+struct URMCompletion
+{
+	/**
+	 * Width of the pulse in microseconds, or URM_INVALID_VALUE if the measure failed.
+	 */
+	unsigned long duration;
+	
+	/**
+	 * Result of the measure (see URMStatus).
+	 */
+	byte status;
+};
+
+#ifdef URM_USE_INSTRUMENTATION
+/**
+ * Statistics collected by URMSensor with URM_USE_INSTRUMENTATION (see URMSensor::getStatistics()).
+ * All times are in microseconds.
+ */
+struct URMStatistics
+{
+	/**
+	 * Number of measures started.
+	 */
+	unsigned long measureCount;
+	
+	/**
+	 * Number of times the state was refreshed while measuring (by refreshState() or by URMSensorArray),
+	 * average and maximal number of them per measure.
+	 */
+	unsigned long pollCount;
+	unsigned long averagePollsPerMeasure;
+	unsigned int maxPollsPerMeasure;
+	
+	/**
+	 * Average and maximal time between two refreshes while measuring (the first one is counted
+	 * from the end of the trigger pulse). This is how late the edges of the pulse can be seen,
+	 * so the error of the measure in centimeters is about maxPollGap / usPerCm.
+	 */
+	unsigned long averagePollGap;
+	unsigned long maxPollGap;
+	
+	/**
+	 * Number of edges handled by the interrupt handlers, average and maximal time from the start
+	 * of the handler to the end of the edge processing.
+	 */
+	unsigned long interruptCount;
+	unsigned long averageInterruptTime;
+	unsigned long maxInterruptTime;
+	
+	/**
+	 * Number of measures finished with StatusNoEcho or StatusPulseTooLong.
+	 */
+	unsigned long timeoutCount;
 };
+#endif
+
+/**
+ * Function called by measureDistance() while it waits for the sensor (see measureDistance()).
+ */
+typedef void (*URMYieldHandler)();
+
+/**
+ * Function called by URMSensor::dispatch() and URMSensorArray::dispatch() when the measure
+ * is over.
+ *
+ * @param id Identifier passed to URMSensor::onMeasurementComplete(), or the slot number
+ * for URMSensorArray.
+ *
+ * @param distance Measured distance in centimeters, or URM_INVALID_VALUE if the measure failed.
+ *
+ * @param status Result of the measure (see URMStatus).
+ */
+typedef void (*URMMeasurementHandler)(byte id, unsigned long distance, byte status);
 
 /**
  * A class representing single ultrasonic ranging sensor.
@@ -96,6 +418,33 @@ class URMSensor
 		URMSensor()
 		{
 			_isAttached = false;
+			_currentState = Idle;
+			_status = StatusNone;
+			
+			for (byte i = 0; i < URM_FAILURE_STATUS_COUNT; i++) _failureCounts[i] = 0;
+			_consecutiveFailureCount = 0;
+			
+			_environment = NULL;
+			_filter = NULL;
+			_maxRange = 0;
+			
+			_isMeasuringContinuously = false;
+			_latestDuration = URM_INVALID_VALUE;
+			_latestStatus = StatusNone;
+			_sequenceNumber = 0;
+			
+			_measurementHandler = NULL;
+			
+			_echoMode = EchoPolling;
+			
+		#ifdef URM_MAX_ECHOES
+			_echoCount = 0;
+			_isListeningForEchoes = false;
+		#endif
+			
+		#ifdef URM_USE_INSTRUMENTATION
+			resetStatistics();
+		#endif
 		}
 		
 		
@@ -124,16 +473,20 @@ class URMSensor
 			unsigned long maxPulseDuration, byte trigActiveState, byte echoActiveState,
 			unsigned int trigPulseWidth)
 		{
+			// The TRIG pin is put to its idle state when it becomes an output.
+			_trigActiveState = trigActiveState;
+			_echoActiveState = echoActiveState;
+			
 			setTrigPin(trigPin);
 			setEchoPin(echoPin);
 			
 			_usPerCm = usPerCm;
+			_mmPerUsQ16 = (655360UL + usPerCm / 2) / usPerCm;
 			
-			_timeoutForPulseStart = timeoutForPulseStart;
-			_maxPulseDuration = maxPulseDuration;
-			
-			_trigActiveState = trigActiveState;
-			_echoActiveState = echoActiveState;
+			_timeoutForPulseStart = urmUsToTime(timeoutForPulseStart);
+			_maxPulseDuration = urmUsToTime(maxPulseDuration);
+			_maxRange = 0;
+			_maxRangeDuration = URM_TIME_MAX;
 			
 			_trigPulseWidth = trigPulseWidth;
 			
@@ -147,6 +500,18 @@ class URMSensor
 		 */
 		void detach()
 		{
+		#ifdef URM_USE_INTERRUPTS
+			detachInterruptMode();
+		#endif
+		
+		#ifdef URM_USE_INPUT_CAPTURE
+			detachInputCaptureMode();
+		#endif
+		
+		#ifdef URM_USE_PIO
+			detachPioMode();
+		#endif
+		
 			_isAttached = false;
 		}
 		
@@ -165,7 +530,9 @@ class URMSensor
 		// ====== Methods for asynchronous data reading ===============================================================
 		
 		/**
-		 * Starts the measure.
+		 * Starts the measure. With URM_USE_TIMED_TRIGGER this method returns right after starting
+		 * the trigger pulse, and the pulse is finished by the timer. Otherwise it waits for the end
+		 * of the pulse (up to 10 us for HC-SR04).
 		 */
 		void startMeasure();
 		
@@ -174,7 +541,10 @@ class URMSensor
 		 *
 		 * @return true if this instance currently measures the distance.
 		 */
-		inline boolean isMeasuring();
+		boolean isMeasuring()
+		{
+			return (_currentState == WaitingForPulse || _currentState == Measuring);
+		}
 		
 		/**
 		 * Interrupts the measure.
@@ -206,131 +576,579 @@ class URMSensor
 		 */
 		unsigned long getMeasuredDistance();
 		
-		
-		
-		// ====== Synchronous distance reading ========================================================================
-		
 		/**
-		 * Synchronously gets the distance in front of the sensor. Maximal working time for 
-		 * this method is (timeoutForPulseStart + maxPulseDuration) us. This method is suitable
-		 * for simple applications or for situations when you just need to get distance and 
-		 * don't mind if the board's core will be busy for 40-50 ms doing it.
+		 * Retrieves the value from the previous measure in millimeters. Unlike getMeasuredDistance(),
+		 * this method does not divide: the distance is computed with a single multiplication by
+		 * the precomputed fixed-point constant, which is much faster on 8-bit boards. Distances up to
+		 * 65 m are supported.
 		 *
-		 * @return Distance in front of the sensor in centimeters, or URM_INVALID_VALUE
-		 * in case of failure.
+		 * @return Distance from the previous measure in millimeters, or URM_INVALID_VALUE if 
+		 * the previous measure failed or if this instance is currently measuring the distance.
 		 */
-		unsigned long measureDistance();
-		
-		// ====== Debugging-related methods ===========================================================================
+		unsigned long getMeasuredDistanceMm()
+		{
+			if (_currentState != FinishedMeasure) return URM_INVALID_VALUE;
+			
+			return convertDurationToMm(urmTimeToUs(_currentDuration));
+		}
 		
 		/**
-		 * Retrieves current state of this instance. May be useful for debugging
-		 * any sensor- or library-related issues.
+		 * Retrieves the width of the pulse from the previous measure, without converting it to distance.
+		 *
+		 * @return Pulse width from the previous measure in microseconds, or URM_INVALID_VALUE if 
+		 * the previous measure failed or if this instance is currently measuring the distance.
 		 */
-		byte getState()
+		unsigned long getRawPulseWidth()
 		{
-			return _currentState;
+			if (_currentState != FinishedMeasure) return URM_INVALID_VALUE;
+			
+			return urmTimeToUs(_currentDuration);
 		}
 		
-	private:
-		boolean _isAttached;
-		
-	#ifndef URM_USE_PORTS_DIRECTLY
-		byte _trigPin;
-		byte _echoPin;
-	#else	
-		byte _trigMask;
-		volatile byte* _trigPORT;
-		volatile byte* _trigPIN;
-		volatile byte* _trigDDR;
-		
-		byte _echoMask;
-		volatile byte* _echoPORT;
-		volatile byte* _echoPIN;
-		volatile byte* _echoDDR;
-	#endif
-	
-		void setTrigPin(byte trigPin)
+		/**
+		 * Sets the maximal distance you are interested in. If the pulse gets longer than it takes for this
+		 * distance, the measure is finished early with OutOfRange state, so you don't have to wait for 
+		 * the sensor's own timeout. Note that the sensor itself may keep the ECHO line active until
+		 * its timeout (HC-SR04 does), and the next measure can't be started before that.
+		 *
+		 * With setEnvironment(), the range is converted to the pulse width at the start of every
+		 * measure, so it follows the changes of the environment.
+		 *
+		 * @param maxRange Maximal distance in centimeters, or 0 to wait for the whole pulse. The distances
+		 * over 65535 cm are too far for any sensor, so they are the same as 0.
+		 */
+		void setMaxRange(unsigned long maxRange)
 		{
-		#ifdef URM_USE_PORTS_DIRECTLY
-			_trigMask = digitalPinToBitMask(trigPin);
-			
-			byte trigPortIndex = digitalPinToPort(trigPin);
-			_trigPORT = portOutputRegister(trigPortIndex);
-			_trigPIN = portInputRegister(trigPortIndex);
-			_trigDDR = portModeRegister(trigPortIndex);
-		#else
-			_trigPin = trigPin;
-		#endif
-
-			setTrigMode(OUTPUT);
+			_maxRange = (maxRange > 0xFFFF) ? 0 : maxRange;
+			updateMaxRangeDuration();
 		}
 		
-		byte fastDigitalReadTrig()
+		/**
+		 * Makes this instance take the speed of sound from the given environment instead of the usPerCm
+		 * constant passed to attach(). The same environment can be shared by any number of sensors. 
+		 * Use it only for the sensors that report the time of flight (like HC-SR04): DFRobot URM37
+		 * compensates the temperature by itself.
+		 *
+		 * @param environment The environment to use, or NULL to go back to the usPerCm constant.
+		 */
+		void setEnvironment(URMEnvironment* environment)
 		{
-			byte state = LOW;
-			setTrigMode(INPUT);
-			
-		#ifdef URM_USE_PORTS_DIRECTLY
-			return ((*_trigPIN & _trigMask) != 0) ? HIGH : LOW;
-		#else
-			state = digitalRead(_trigPin);
-		#endif
-		
-			setTrigMode(OUTPUT);
-			return state;
+			_environment = environment;
+			updateMaxRangeDuration();
 		}
 		
-		void setTrigMode(byte newMode)
+		/**
+		 * Retrieves the environment set by setEnvironment().
+		 *
+		 * @return The environment, or NULL if the usPerCm constant is used.
+		 */
+		URMEnvironment* getEnvironment()
 		{
-		#ifdef URM_USE_PORTS_DIRECTLY
-			if (newMode == OUTPUT)
-			{
-				*_trigDDR |= _trigMask;
-			}
-			else
-			{
-				*_trigDDR &= ~_trigMask;
-			}
-		#else
-			pinMode(_trigPin, newMode);
-		#endif
+			return _environment;
 		}
 		
-		void fastDigitalWriteTrig(byte value)
+		
+		
+		/**
+		 * Makes this instance pass the result of every successful measure through the given filter
+		 * (see URMFilter). The filter works with the pulse widths, so it does not have to be reset
+		 * if the environment changes.
+		 *
+		 * @param filter The filter to use, or NULL to stop filtering. Every sensor needs its own filter.
+		 */
+		void setFilter(URMFilter* filter)
 		{
-		#ifdef URM_USE_PORTS_DIRECTLY
-			if (value == HIGH)
-				*_trigPORT |= _trigMask;
-			else
-				*_trigPORT &= ~_trigMask;
-		#else
-			digitalWrite(_trigPin, value);
-		#endif
+			_filter = filter;
 		}
 		
-		void setEchoPin(byte echoPin)
+		/**
+		 * Retrieves the filter set by setFilter().
+		 *
+		 * @return The filter, or NULL if the results are not filtered.
+		 */
+		URMFilter* getFilter()
+		{
+			return _filter;
+		}
+		
+		/**
+		 * Retrieves the filtered distance. The filter is updated as soon as a measure succeeds, so
+		 * this method only converts its value to centimeters. Unlike getMeasuredDistance(), 
+		 * the value stays available while the next measure is in progress.
+		 *
+		 * @return Filtered distance in centimeters, or URM_INVALID_VALUE if there's no filter
+		 * or no measure succeeded since it was set.
+		 */
+		unsigned long getFilteredDistance();
+		
+		/**
+		 * Retrieves the filtered distance in millimeters (see getFilteredDistance() and
+		 * getMeasuredDistanceMm()).
+		 *
+		 * @return Filtered distance in millimeters, or URM_INVALID_VALUE if there's no filter
+		 * or no measure succeeded since it was set.
+		 */
+		unsigned long getFilteredDistanceMm();
+		
+		
+		
+		// ====== Continuous measuring ================================================================================
+		
+		/**
+		 * Starts measuring the distance continuously: every time the measure is over, the next one is
+		 * started by refreshState() (and therefore by finishedMeasure()) as soon as the given time has
+		 * passed since the previous start. Results are available via getLatestDistance(), since
+		 * getMeasuredDistance() will mostly see the measure in progress.
+		 *
+		 * @param minCycleTime Minimal time between starts of two measures, in microseconds. The sensor
+		 * may need some time to recover after the measure (the HC-SR04 datasheet suggests 60 ms).
+		 */
+		void startContinuousMeasure(unsigned long minCycleTime);
+		
+		/**
+		 * Stops measuring the distance continuously. The measure in progress will not be interrupted.
+		 */
+		void stopContinuousMeasure();
+		
+		/**
+		 * Indicates whether this instance measures the distance continuously.
+		 */
+		boolean isMeasuringContinuously()
+		{
+			return _isMeasuringContinuously;
+		}
+		
+		/**
+		 * Retrieves the result of the latest finished measure. Unlike getMeasuredDistance(), the value
+		 * is kept while the next measure is in progress.
+		 *
+		 * @return Distance in centimeters, or URM_INVALID_VALUE if the latest measure failed.
+		 */
+		unsigned long getLatestDistance();
+		
+		/**
+		 * Retrieves the number of finished (successfully or not) measures. Compare it with the value
+		 * you saw before to find out whether getLatestDistance() has a new result.
+		 */
+		unsigned int getSequenceNumber();
+		
+		
+		
+		// ====== Events ==============================================================================================
+		
+		/**
+		 * Sets the function that dispatch() will call when the measure is over, so you don't have 
+		 * to check the state of the sensor by yourself.
+		 *
+		 * @param handler The function to call, or NULL to stop calling it.
+		 *
+		 * @param id Identifier passed to the function, so the same function can serve several sensors.
+		 */
+		void onMeasurementComplete(URMMeasurementHandler handler, byte id = 0);
+		
+		/**
+		 * Refreshes the state of this instance (see refreshState()) and calls the function set by
+		 * onMeasurementComplete() once for every measure finished since the previous call, oldest first.
+		 * Call this method in your loop() function; the function is called from there, never from
+		 * an interrupt handler. The measures are kept till then even if they were finished by the interrupt
+		 * handlers or by refreshState() called elsewhere, up to (URM_DISPATCH_QUEUE_SIZE - 1) of them.
+		 */
+		void dispatch();
+		
+		/**
+		 * Retrieves the number of finished measures that were not passed to the handler because
+		 * dispatch() was not called in time. The counter wraps around after 255.
+		 */
+		byte getDroppedDispatchCount()
+		{
+			return _completions.getDroppedCount();
+		}
+		
+		
+		
+	#ifdef URM_SAMPLE_BUFFER_SIZE
+		// ====== Sample buffer =======================================================================================
+		
+		/**
+		 * Retrieves the number of samples waiting in the buffer.
+		 */
+		byte getSampleCount()
+		{
+			return _samples.getCount();
+		}
+		
+		/**
+		 * Takes the oldest sample from the buffer. It's safe to call this method while the interrupt
+		 * handlers are adding new samples, and it never disables interrupts.
+		 *
+		 * @return true if the sample was taken, or false if the buffer is empty.
+		 */
+		boolean readSample(URMSample& sample)
+		{
+			return _samples.pop(sample);
+		}
+		
+		/**
+		 * Takes up to maxCount oldest samples from the buffer at once. It's safe to call this method 
+		 * while the interrupt handlers are adding new samples, and it never disables interrupts.
+		 *
+		 * @return Number of samples taken.
+		 */
+		byte readSamples(URMSample* samples, byte maxCount)
+		{
+			return _samples.pop(samples, maxCount);
+		}
+		
+		/**
+		 * Retrieves the number of samples lost because the buffer was full. The counter wraps around
+		 * after 255.
+		 */
+		byte getDroppedSampleCount()
+		{
+			return _samples.getDroppedCount();
+		}
+		
+		
+		
+	#endif
+	#ifdef URM_MAX_ECHOES
+		// ====== Multiple echoes =====================================================================================
+		
+		/**
+		 * Retrieves the number of echoes caught since the previous measure has finished. The first one is
+		 * the echo getMeasuredDistance() returns; the later ones are caught while you keep calling refreshState()
+		 * (or finishedMeasure()) after the measure, until URM_MAX_ECHOES echoes are caught, the time the sensor
+		 * can report a target in is over, or the next measure starts.
+		 *
+		 * The later echoes are only caught in polling and interrupt modes: the hardware of other modes
+		 * stops at the first pulse. URMSensorArray stops refreshing the sensors of the group as soon as
+		 * the group is finished, so only the interrupt mode catches them there.
+		 *
+		 * @return Number of echoes, or 0 if the measure failed or the instance is measuring.
+		 */
+		byte getEchoCount()
+		{
+			return _echoCount;
+		}
+		
+		/**
+		 * Retrieves the distance to the target of the given echo. Every echo is measured from the start
+		 * of the first pulse to its own end, so the first one is the same as getMeasuredDistance().
+		 *
+		 * @param index Number of the echo, less than getEchoCount().
+		 *
+		 * @return Distance in centimeters, or URM_INVALID_VALUE if there's no such echo.
+		 */
+		unsigned long getEchoDistance(byte index)
+		{
+			if (index >= _echoCount) return URM_INVALID_VALUE;
+			
+			return convertDurationToDistance(_echoDurations[index]);
+		}
+		
+		/**
+		 * Retrieves the distance to the target of the given echo in millimeters. See getEchoDistance().
+		 *
+		 * @param index Number of the echo, less than getEchoCount().
+		 *
+		 * @return Distance in millimeters, or URM_INVALID_VALUE if there's no such echo.
+		 */
+		unsigned long getEchoDistanceMm(byte index)
+		{
+			if (index >= _echoCount) return URM_INVALID_VALUE;
+			
+			return convertDurationToMm(_echoDurations[index]);
+		}
+		
+		
+		
+	#endif
+		// ====== Echo capture modes ==================================================================================
+		
+		/**
+		 * Retrieves the way this instance catches the edges of the ECHO pulse.
+		 *
+		 * @return One of URMEchoMode values.
+		 */
+		byte getEchoMode()
+		{
+			return _echoMode;
+		}
+		
+	#ifdef URM_USE_INTERRUPTS
+		/**
+		 * Switches this instance to the interrupt-driven mode. In this mode the edges of the ECHO pulse
+		 * are timestamped by the library's own interrupt handler, so the measured distance does not depend
+		 * on how often you call finishedMeasure() or refreshState(). You still have to call finishedMeasure()
+		 * to check the result - it will also detect timeouts. Call this method after attach().
+		 *
+		 * External interrupts (INTx) are used if the ECHO pin supports them, otherwise the pin change
+		 * interrupts (PCINTx) are used on AVR boards.
+		 *
+		 * @return true if the interrupt handler was attached to the ECHO pin, or false if the pin 
+		 * supports neither kind of interrupts, the instance is not attached, or there are already
+		 * URM_MAX_INTERRUPT_SENSORS sensors working in interrupt mode.
+		 */
+		boolean attachInterruptMode();
+		
+		/**
+		 * Switches this instance back to polling mode.
+		 */
+		void detachInterruptMode();
+	#endif
+		
+	#ifdef URM_USE_INPUT_CAPTURE
+		/**
+		 * Switches this instance to the hardware input capture mode. Both edges of the ECHO pulse are 
+		 * latched by the input capture unit of Timer1, so the pulse width is exact to one timer tick
+		 * (62.5 ns on 16 MHz boards) and the CPU is not involved while the pulse lasts. You still have 
+		 * to call finishedMeasure() to check the result and detect timeouts. Call this method after attach().
+		 *
+		 * Only one sensor can work in this mode, and its ECHO pin must be connected to the ICP1 pin
+		 * (pin 8 on Arduino Uno, pin 4 on Arduino Leonardo).
+		 *
+		 * @return true if the input capture unit was attached to this instance, or false if the ECHO pin
+		 * is not the ICP1 pin, the instance is not attached, or the input capture unit is already in use.
+		 */
+		boolean attachInputCaptureMode();
+		
+		/**
+		 * Switches this instance back to polling mode and releases the input capture unit.
+		 */
+		void detachInputCaptureMode();
+		
+		/**
+		 * Retrieves the width of the pulse from the previous measure in Timer1 ticks. It is more precise
+		 * than the width in microseconds used by getMeasuredDistance().
+		 *
+		 * @return Pulse width in Timer1 ticks, or URM_INVALID_VALUE if the previous measure failed or 
+		 * if this instance is currently measuring the distance.
+		 */
+		unsigned long getPulseWidthTicks();
+	#endif
+		
+	#ifdef URM_USE_PIO
+		/**
+		 * Switches this instance to the PIO mode. The PIO state machine makes the trigger pulse and measures
+		 * the echo pulse by itself, exact to 2 clock cycles of the CPU (16 ns at 125 MHz), so startMeasure()
+		 * does not have to wait for the end of the trigger pulse, and the CPU is not involved while
+		 * the pulse lasts. You still have to call finishedMeasure() to check the result and detect timeouts.
+		 * Call this method after attach().
+		 *
+		 * Any pins can be used, and up to 8 sensors can work in this mode at the same time.
+		 *
+		 * @return true if the state machine was attached to this instance, or false if the instance is not
+		 * attached, it works in another echo capture mode, or there are no free state machines or
+		 * instruction memory left.
+		 */
+		boolean attachPioMode();
+		
+		/**
+		 * Switches this instance back to polling mode and releases the state machine.
+		 */
+		void detachPioMode();
+	#endif
+		
+		
+		
+		// ====== Synchronous distance reading ========================================================================
+		
+		/**
+		 * Synchronously gets the distance in front of the sensor. Maximal working time for 
+		 * this method is (timeoutForPulseStart + maxPulseDuration) us. This method is suitable
+		 * for simple applications or for situations when you just need to get distance and 
+		 * don't mind if the board's core will be busy for 40-50 ms doing it.
+		 *
+		 * While waiting, this method calls the Arduino yield() function, so the tasks hooked to it
+		 * (by the Scheduler library, for example) keep running.
+		 *
+		 * @return Distance in front of the sensor in centimeters, or URM_INVALID_VALUE
+		 * in case of failure.
+		 */
+		unsigned long measureDistance()
+		{
+			return measureDistance(yield);
+		}
+		
+		/**
+		 * Synchronously gets the distance in front of the sensor, calling the given function while
+		 * waiting for the sensor, so your sketch can do something useful instead of just spinning.
+		 * The state of the sensor is refreshed between the calls, so in polling mode (see
+		 * getEchoMode()) the time spent in the function is also the maximal error of the measure:
+		 * keep it short, about 50 us gives 1 cm. With attachInterruptMode() or attachInputCaptureMode()
+		 * the edges are caught by the hardware, and the function may take as long as you wish.
+		 *
+		 * With URM_USE_SLEEP in these modes, the board sleeps between the interrupts, and the function
+		 * is called every time it wakes up (at least once per millisecond, on the millis() tick).
+		 *
+		 * @param yieldHandler The function to call, or NULL to just wait.
+		 *
+		 * @return Distance in front of the sensor in centimeters, or URM_INVALID_VALUE
+		 * in case of failure.
+		 */
+		unsigned long measureDistance(URMYieldHandler yieldHandler);
+		
+	#ifdef URM_USE_SLEEP
+		/**
+		 * Puts the board to IDLE sleep till the next interrupt: the edge of the echo, the compare match
+		 * finishing the trigger pulse or the Timer0 overflow that drives millis() (every 1024 us
+		 * on 16 MHz boards), so the timeouts are noticed at most a millisecond late. Everything but
+		 * the core keeps running, so the timing is not affected.
+		 *
+		 * Call it in your loop() function after update() or dispatch() when all sensors work
+		 * in the interrupt or input capture modes, to spend most of the measure asleep.
+		 */
+		static void sleepUntilInterrupt();
+	#endif
+		
+		// ====== Debugging-related methods ===========================================================================
+		
+		/**
+		 * Retrieves current state of this instance. May be useful for debugging
+		 * any sensor- or library-related issues.
+		 */
+		byte getState()
+		{
+			return _currentState;
+		}
+		
+		/**
+		 * Retrieves the result of the latest measure. Unlike getState(), it tells why the measure
+		 * failed, so you can decide whether to retry immediately or to back off.
+		 *
+		 * @return One of URMStatus values.
+		 */
+		byte getStatus()
+		{
+			return _status;
+		}
+		
+		/**
+		 * Retrieves the number of measures that failed with the given status since the startup
+		 * or resetFailureCounts() call.
+		 *
+		 * @param status One of failure statuses (StatusNotAttached to StatusOutOfRange).
+		 *
+		 * @return Number of failures, or 0 for statuses that are not failures.
+		 */
+		unsigned int getFailureCount(byte status);
+		
+		/**
+		 * Retrieves the number of measures that failed in a row (up to 255). It is reset by every
+		 * successful measure.
+		 */
+		byte getConsecutiveFailureCount()
+		{
+			return _consecutiveFailureCount;
+		}
+		
+		/**
+		 * Resets all failure counters.
+		 */
+		void resetFailureCounts();
+		
+	#ifdef URM_USE_INSTRUMENTATION
+		/**
+		 * Retrieves the statistics collected since the startup or resetStatistics() call.
+		 *
+		 * @param statistics Structure to fill.
+		 */
+		void getStatistics(URMStatistics& statistics);
+		
+		/**
+		 * Resets the statistics.
+		 */
+		void resetStatistics();
+		
+		/**
+		 * Prints the statistics in human-readable form, for example, to Serial.
+		 */
+		void dumpStatistics(Print& output);
+	#endif
+		
+	private:
+		boolean _isAttached;
+		
+		byte _trigPin;
+		byte _echoPin;
+		
+	#ifdef URM_USE_PORTS_DIRECTLY
+		// The registers are taken from URMFastGpio.h. On AVR the output register is PORTx, and
+		// both the set and clear registers are the PINx register.
+		URMPortMask _trigMask;
+		URMPortRegister* _trigOUT;
+		URMPortRegister* _trigSET;
+		URMPortRegister* _trigCLR;
+		
+		URMPortMask _echoMask;
+		URMPortRegister* _echoIN;
+	#endif
+	
+		void setTrigPin(byte trigPin)
+		{
+			_trigPin = trigPin;
+			
+		#ifdef URM_USE_PORTS_DIRECTLY
+			_trigMask = urmPinMask(trigPin);
+			_trigOUT = urmPinOutputRegister(trigPin);
+			_trigSET = urmPinSetRegister(trigPin);
+			_trigCLR = urmPinClearRegister(trigPin);
+		#endif
+
+			// The idle state is written both before and after switching the mode: the cores that keep
+			// the output latch don't make a glitch the sensor could take for the trigger pulse, and
+			// the ones that reset it still get the right state.
+			byte idleState = getOppositeStateFor(_trigActiveState);
+			fastDigitalWriteTrig(idleState);
+			setTrigMode(OUTPUT);
+			fastDigitalWriteTrig(idleState);
+		}
+		
+		byte fastDigitalReadTrig()
+		{
+			// The output latch is read, so the pin doesn't have to be switched to INPUT and back.
+		#ifdef URM_USE_PORTS_DIRECTLY
+			return ((*_trigOUT & _trigMask) != 0) ? HIGH : LOW;
+		#else
+			return digitalRead(_trigPin);
+		#endif
+		}
+		
+		void setTrigMode(byte newMode)
+		{
+			// The mode is only changed at attach(), so there's no need to do it fast (and every
+			// architecture does it in its own way).
+			pinMode(_trigPin, newMode);
+		}
+		
+		void fastDigitalWriteTrig(byte value)
+		{
+		#ifdef URM_USE_PORTS_DIRECTLY
+			if (value == HIGH)
+				urmSetPortBits(_trigOUT, _trigSET, _trigMask);
+			else
+				urmClearPortBits(_trigOUT, _trigCLR, _trigMask);
+		#else
+			digitalWrite(_trigPin, value);
+		#endif
+		}
+		
+		void setEchoPin(byte echoPin)
 		{
-		#ifdef URM_USE_PORTS_DIRECTLY
-			_echoMask = digitalPinToBitMask(echoPin);
-			
-			byte echoPortIndex = digitalPinToPort(echoPin);
-			_echoPORT = portOutputRegister(echoPortIndex);
-			_echoPIN = portInputRegister(echoPortIndex);
-			_echoDDR = portModeRegister(echoPortIndex);
-			
-			*_echoDDR &= ~_echoMask;
-			*_echoPORT &= ~_echoMask;
-		#else
 			_echoPin = echoPin;
-			pinMode(_echoPin, INPUT);
+			
+		#ifdef URM_USE_PORTS_DIRECTLY
+			_echoMask = urmPinMask(echoPin);
+			_echoIN = urmPinInputRegister(echoPin);
 		#endif
+			
+			pinMode(_echoPin, INPUT);
 		}
 		
 		byte fastDigitalReadEcho()
 		{
 		#ifdef URM_USE_PORTS_DIRECTLY
-			return ((*_echoPIN & _echoMask) != 0) ? HIGH : LOW;
+			return ((*_echoIN & _echoMask) != 0) ? HIGH : LOW;
 		#else
 			return digitalRead(_echoPin);
 		#endif
@@ -338,8 +1156,18 @@ class URMSensor
 		
 		int _usPerCm;
 		
-		unsigned long _timeoutForPulseStart;
-		unsigned long _maxPulseDuration;
+		// The limits are kept in the units of URMTime, so the state machine doesn't convert them.
+		URMTime _timeoutForPulseStart;
+		URMTime _maxPulseDuration;
+		URMTime _maxRangeDuration;
+		
+		// The range set by setMaxRange(), in centimeters (0 if there's none).
+		unsigned int _maxRange;
+		
+		/**
+		 * Converts the range set by setMaxRange() to _maxRangeDuration with the current speed of sound.
+		 */
+		void updateMaxRangeDuration();
 		
 		byte _trigActiveState;
 		byte _echoActiveState;
@@ -351,27 +1179,221 @@ class URMSensor
 		
 		unsigned int _trigPulseWidth;
 		
-		unsigned long _startMeasureTime;
-		unsigned long _currentDuration;
+		volatile URMTime _startMeasureTime;
+		volatile URMTime _currentDuration;
 		
 		void resetTime()
 		{
 			_currentDuration = 0;
-			_startMeasureTime = micros();
+			_startMeasureTime = urmNow();
 		}
 		
-		unsigned long getCurrentDuration()
+		URMTime getCurrentDuration(URMTime now)
 		{
-			_currentDuration = micros() - _startMeasureTime;
-			return _currentDuration;
+			URMTime duration = urmElapsed(now, _startMeasureTime);
+			
+		#ifdef URM_USE_TICK_TIMING
+			// The duration only grows while measuring, so if it got shorter, the counter has wrapped
+			// around since the previous refresh: the time is surely over any timeout.
+			if (duration < _currentDuration) duration = URM_TIME_MAX;
+		#endif
+			
+			_currentDuration = duration;
+			return duration;
 		}
 		
+		URMEnvironment* _environment;
+		URMFilter* _filter;
+		
+		/**
+		 * Retrieves the filtered pulse width, or URM_INVALID_VALUE if there's none.
+		 */
+		unsigned long getFilteredDuration();
+		
 		unsigned long convertCurrentDurationToDistance()
 		{
-			return _currentDuration / _usPerCm;
+			return convertDurationToDistance(urmTimeToUs(_currentDuration));
+		}
+		
+		unsigned long convertDurationToDistance(unsigned long duration)
+		{
+			if (_environment != NULL) return (duration * _environment->getCmPerUsQ16()) >> 16;
+			
+			return duration / _usPerCm;
+		}
+		
+		// Distance in mm per 1 us of the pulse, in 16.16 fixed-point format.
+		unsigned long _mmPerUsQ16;
+		
+		unsigned long convertDurationToMm(unsigned long duration)
+		{
+			unsigned long mmPerUsQ16 = (_environment != NULL) ? _environment->getMmPerUsQ16() : _mmPerUsQ16;
+			
+			return (duration * mmPerUsQ16 + 0x8000) >> 16;
 		}
 
-		byte _currentState;
+		volatile byte _currentState;
+		
+		/**
+		 * Advances the state machine using the given state of the ECHO pin, sampled at the given
+		 * time (in us). This is the common part of refreshState() and all interrupt handlers.
+		 */
+		void updateState(byte echoState, URMTime now);
+		
+		/**
+		 * Checks whether the measure can be started. This is the part of startMeasure() done
+		 * before the trigger pulse.
+		 *
+		 * @return true if the trigger pulse should be sent to the sensor.
+		 */
+		boolean prepareMeasure();
+		
+		/**
+		 * Starts waiting for the echo. This is the part of startMeasure() done after the trigger pulse.
+		 */
+		void beginMeasure();
+		
+		/**
+		 * Finishes the measure with the given state and status, saves its result as the latest one
+		 * and counts the failure, if any.
+		 */
+		void completeMeasure(byte newState, byte status);
+		
+		volatile byte _status;
+		
+		volatile unsigned int _failureCounts[URM_FAILURE_STATUS_COUNT];
+		volatile byte _consecutiveFailureCount;
+		
+		boolean _isMeasuringContinuously;
+		unsigned long _minCycleTime;
+		unsigned long _cycleStartTime;
+		
+		volatile unsigned long _latestDuration;
+		volatile byte _latestStatus;
+		volatile unsigned int _sequenceNumber;
+		
+		URMMeasurementHandler _measurementHandler;
+		byte _handlerId;
+		
+		// The measures finished while the handler was set, waiting for dispatch().
+		URMRingBuffer<URMCompletion, URM_DISPATCH_QUEUE_SIZE> _completions;
+		
+	#ifdef URM_SAMPLE_BUFFER_SIZE
+		URMRingBuffer<URMSample, URM_SAMPLE_BUFFER_SIZE> _samples;
+	#endif
+		
+		// URMSensorArray samples the ECHO pins of its sensors by itself.
+		friend class URMSensorArray;
+		
+		volatile byte _echoMode;
+		
+	#ifdef URM_MAX_ECHOES
+		// Times from the start of the first pulse to the ends of the echoes caught so far.
+		unsigned long _echoDurations[URM_MAX_ECHOES];
+		volatile byte _echoCount;
+		
+		volatile boolean _isListeningForEchoes;
+		byte _listenedEchoState;
+		
+		/**
+		 * Catches the ends of the echoes after the measure has finished.
+		 */
+		void listenForEchoes(byte echoState, URMTime now);
+	#endif
+		
+	#ifdef URM_USE_INSTRUMENTATION
+		volatile unsigned long _measureCount;
+		volatile unsigned long _pollCount;
+		volatile unsigned int _currentPollCount;
+		volatile unsigned int _maxPollsPerMeasure;
+		volatile URMTime _lastPollTime;
+		volatile unsigned long _pollGapSum;
+		volatile unsigned long _maxPollGap;
+		volatile unsigned long _interruptCount;
+		volatile unsigned long _interruptTimeSum;
+		volatile unsigned long _maxInterruptTime;
+		volatile unsigned long _timeoutCount;
+		
+		/**
+		 * Counts the refresh of the state done at the given time while measuring.
+		 */
+		void recordPoll(URMTime now);
+		
+		/**
+		 * Counts the interrupt handler started at the given time (see urmNow()).
+		 */
+		void recordInterrupt(URMTime start);
+	#endif
+		
+	#ifdef URM_USE_INTERRUPTS
+		byte _interruptSlot;
+		byte _pcintBank;
+		
+		// State of the ECHO pin seen by the previous pin change interrupt of the bank.
+		byte _pinChangeEchoState;
+		
+		static URMSensor* volatile _interruptSensors[URM_MAX_INTERRUPT_SENSORS];
+		
+		// Sensors working with pin change interrupts, without gaps, so the handler only goes
+		// through them.
+		static URMSensor* volatile _pinChangeSensors[URM_MAX_INTERRUPT_SENSORS];
+		static volatile byte _pinChangeSensorCount;
+		
+		void handleEchoInterrupt(byte echoState, URMTime now)
+		{
+			updateState(echoState, now);
+			
+		#ifdef URM_USE_INSTRUMENTATION
+			recordInterrupt(now);
+		#endif
+		}
+		
+		friend void urmDispatchExternalInterrupt(byte slot);
+		friend void urmDispatchPinChange(byte bank);
+	#endif
+	
+	#ifdef URM_USE_INPUT_CAPTURE
+		// Timestamp of the pulse start while measuring, and pulse width after that (in Timer1 ticks).
+		volatile unsigned long _captureTicks;
+		
+		static URMSensor* volatile _inputCaptureSensor;
+		
+		void handleInputCapture(unsigned long ticks);
+		
+		friend void urmDispatchInputCapture(unsigned int capture);
+	#endif
+	
+	#ifdef URM_USE_TIMED_TRIGGER
+		/**
+		 * Starts the trigger pulse and schedules its end on the compare unit of Timer1.
+		 *
+		 * @return true if the pulse was started, or false if it has to be done by hand.
+		 */
+		boolean startTimedTrigger();
+		
+		/**
+		 * Indicates whether the TRIG pin is the output of the given compare unit of Timer1.
+		 */
+		boolean isTrigCompareOutput(byte channel);
+		
+		friend void urmDispatchTriggerCompare(byte channel);
+	#endif
+	
+	#ifdef URM_USE_PIO
+		PIO _pio;
+		byte _pioStateMachine;
+		byte _pioProgramOffset;
+		
+		/**
+		 * Restarts the state machine, so it makes the trigger pulse and waits for the echo.
+		 */
+		void startPioMeasure();
+		
+		/**
+		 * Reads the words the state machine has sent since the previous call.
+		 */
+		void readPioResults(URMTime now);
+	#endif
 };
 
 class URM37 : public URMSensor
@@ -0,0 +1,472 @@
+#include "URMSensorArray.h"
+
+URMSensorArray::URMSensorArray()
+{
+	_sensorCount = 0;
+
+	_currentGroup = 0;
+	_groupIsMeasuring = false;
+
+	_guardTime = URM_ARRAY_DEFAULT_GUARD_TIME;
+	_lastTriggerTime = 0;
+
+	_sweepCount = 0;
+
+	_minInterval = 0;
+	_maxInterval = 0;
+	_nearDistance = URM_ARRAY_DEFAULT_NEAR_DISTANCE;
+	_farDistance = URM_ARRAY_DEFAULT_FAR_DISTANCE;
+	_speedThreshold = URM_ARRAY_DEFAULT_SPEED_THRESHOLD;
+
+	_maxJitter = 0;
+	_currentJitter = 0;
+	_randomState = 1;
+
+	_maxClosingSpeed = 0;
+	_maxRejectCount = URM_ARRAY_DEFAULT_MAX_REJECT_COUNT;
+
+	_measurementHandler = NULL;
+}
+
+byte URMSensorArray::addSensor(URMSensor& sensor, byte group)
+{
+	if (_sensorCount == URM_ARRAY_MAX_SENSORS) return URM_ARRAY_INVALID_SLOT;
+
+	byte slot = _sensorCount;
+
+	_sensors[slot] = &sensor;
+	_groups[slot] = group;
+	_distances[slot] = URM_INVALID_VALUE;
+	_statuses[slot] = StatusNone;
+	_triggerTimes[slot] = 0;
+	_intervals[slot] = 0;
+	_acceptedDistances[slot] = URM_INVALID_VALUE;
+	_acceptedTimes[slot] = 0;
+	_rejectCounts[slot] = 0;
+
+	_sensorCount++;
+	return slot;
+}
+
+void URMSensorArray::update()
+{
+	if (_sensorCount == 0) return;
+
+	// Waiting for the current group to finish...
+	if (_groupIsMeasuring)
+	{
+		if (!finishGroup()) return;
+
+		selectNextGroup();
+	}
+
+	// ...and for the echoes to fade away before firing the next one.
+	if (micros() - _lastTriggerTime < _guardTime + _currentJitter) return;
+
+	// With the adaptive sampling, there may be nothing to fire yet.
+	if ((_maxInterval != 0) && !selectDueGroup()) return;
+
+	startGroup();
+}
+
+void URMSensorArray::onMeasurementComplete(URMMeasurementHandler handler)
+{
+	_measurementHandler = handler;
+
+	// The measures finished before are not passed to the new handler.
+	URMArrayCompletion completion;
+	while (_completions.pop(completion)) ;
+}
+
+void URMSensorArray::dispatch()
+{
+	update();
+
+	// The handler may be changed by the handler itself, so it is taken again for every measure.
+	URMArrayCompletion completion;
+	while ((_measurementHandler != NULL) && _completions.pop(completion))
+	{
+		_measurementHandler(completion.slot, completion.distance, completion.status);
+	}
+}
+
+void URMSensorArray::startGroup()
+{
+#ifdef URM_USE_PORTS_DIRECTLY
+	prepareSampling();
+#endif
+
+	_lastTriggerTime = micros();
+	_currentJitter = nextJitter();
+
+	triggerGroup();
+
+	// The group could become empty after setGroup() call, so we'll try the next one.
+	if (!_groupIsMeasuring) selectNextGroup();
+}
+
+boolean URMSensorArray::finishGroup()
+{
+	// Every sensor must be refreshed, so we don't stop at the first one that is still measuring.
+	boolean groupFinished = true;
+
+#ifdef URM_USE_PORTS_DIRECTLY
+	sampleGroup();
+#endif
+
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		if (_groups[slot] != _currentGroup) continue;
+
+	#ifdef URM_USE_PORTS_DIRECTLY
+		// This sensor was already refreshed by sampleGroup().
+		if (_echoPortIndices[slot] != URM_ARRAY_INVALID_SLOT)
+		{
+			if (_sensors[slot]->isMeasuring()) groupFinished = false;
+			continue;
+		}
+	#endif
+
+		if (!_sensors[slot]->finishedMeasure()) groupFinished = false;
+	}
+
+	if (!groupFinished) return false;
+
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		if (_groups[slot] != _currentGroup) continue;
+
+		unsigned long distance = _sensors[slot]->getMeasuredDistance();
+		byte status = _sensors[slot]->getStatus();
+
+		if ((_maxClosingSpeed != 0) && !isPlausible(slot, distance))
+		{
+			distance = URM_INVALID_VALUE;
+			status = StatusRejected;
+		}
+
+		// The suspected new obstacle must be confirmed quickly, not measured at the slowest rate.
+		if (_maxInterval != 0) _intervals[slot] = (status == StatusRejected) ? _minInterval : computeInterval(slot, distance);
+
+		_distances[slot] = distance;
+		_triggerTimes[slot] = _lastTriggerTime;
+		_statuses[slot] = status;
+
+		if (_measurementHandler != NULL)
+		{
+			URMArrayCompletion completion;
+			completion.distance = distance;
+			completion.slot = slot;
+			completion.status = status;
+
+			_completions.push(completion);
+		}
+	}
+
+	_groupIsMeasuring = false;
+	return true;
+}
+
+void URMSensorArray::triggerGroup()
+{
+	boolean triggered[URM_ARRAY_MAX_SENSORS];
+	unsigned int pulseWidth = 0;
+
+#ifdef URM_USE_PORTS_DIRECTLY
+	// Output, set and clear registers of the ports of the TRIG pins, with masks of the pins
+	// to set and to clear for the trigger pulse.
+	URMPortRegister* trigOutputRegisters[URM_ARRAY_MAX_SENSORS];
+	URMPortRegister* trigSetRegisters[URM_ARRAY_MAX_SENSORS];
+	URMPortRegister* trigClearRegisters[URM_ARRAY_MAX_SENSORS];
+	URMPortMask setMasks[URM_ARRAY_MAX_SENSORS];
+	URMPortMask clearMasks[URM_ARRAY_MAX_SENSORS];
+	byte trigPortCount = 0;
+#endif
+
+	// Checking the sensors and collecting their TRIG pins...
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		triggered[slot] = false;
+		if (_groups[slot] != _currentGroup) continue;
+
+		// The sensor that failed to start will just finish the measure immediately.
+		_groupIsMeasuring = true;
+
+		URMSensor* sensor = _sensors[slot];
+		if (!sensor->prepareMeasure()) continue;
+
+		triggered[slot] = true;
+		if (sensor->_trigPulseWidth > pulseWidth) pulseWidth = sensor->_trigPulseWidth;
+
+	#ifdef URM_USE_PORTS_DIRECTLY
+		byte portIndex = 0;
+		while ((portIndex < trigPortCount) && (trigOutputRegisters[portIndex] != sensor->_trigOUT)) portIndex++;
+
+		if (portIndex == trigPortCount)
+		{
+			trigOutputRegisters[portIndex] = sensor->_trigOUT;
+			trigSetRegisters[portIndex] = sensor->_trigSET;
+			trigClearRegisters[portIndex] = sensor->_trigCLR;
+			setMasks[portIndex] = 0;
+			clearMasks[portIndex] = 0;
+			trigPortCount++;
+		}
+
+		if (sensor->_trigActiveState == HIGH) setMasks[portIndex] |= sensor->_trigMask;
+		else clearMasks[portIndex] |= sensor->_trigMask;
+	#endif
+	}
+
+	// ...then sending the trigger pulse to all of them at once (the longest one is used), so
+	// every sensor gets the same start time...
+#ifdef URM_USE_PORTS_DIRECTLY
+	for (byte portIndex = 0; portIndex < trigPortCount; portIndex++)
+	{
+		urmWritePortBits(trigOutputRegisters[portIndex], trigSetRegisters[portIndex], trigClearRegisters[portIndex],
+			setMasks[portIndex], clearMasks[portIndex]);
+	}
+
+	delayMicroseconds(pulseWidth);
+
+	for (byte portIndex = 0; portIndex < trigPortCount; portIndex++)
+	{
+		urmWritePortBits(trigOutputRegisters[portIndex], trigSetRegisters[portIndex], trigClearRegisters[portIndex],
+			clearMasks[portIndex], setMasks[portIndex]);
+	}
+#else
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		if (triggered[slot]) _sensors[slot]->fastDigitalWriteTrig(_sensors[slot]->_trigActiveState);
+	}
+
+	delayMicroseconds(pulseWidth);
+
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		URMSensor* sensor = _sensors[slot];
+		if (triggered[slot]) sensor->fastDigitalWriteTrig(sensor->getOppositeStateFor(sensor->_trigActiveState));
+	}
+#endif
+
+#ifdef URM_USE_PORTS_DIRECTLY
+	// Taken after prepareMeasure(), which starts Timer1 with URM_USE_TICK_TIMING, and before
+	// the sensors reset their own times, so no timeout is missed.
+	_samplingStartTime = urmNow();
+#endif
+
+	// ...and letting them wait for the echo.
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		if (triggered[slot]) _sensors[slot]->beginMeasure();
+	}
+}
+
+void URMSensorArray::selectNextGroup()
+{
+	byte nextGroup = urmSelectNextGroup(_groups, _sensorCount, _currentGroup);
+	if (nextGroup <= _currentGroup) _sweepCount++;
+
+	_currentGroup = nextGroup;
+}
+
+byte urmSelectNextGroup(const byte* groups, byte count, byte currentGroup)
+{
+	// Looking for the smallest group number after the current one...
+	boolean foundNextGroup = false;
+	byte nextGroup = 0;
+	byte firstGroup = groups[0];
+
+	for (byte slot = 0; slot < count; slot++)
+	{
+		byte group = groups[slot];
+
+		if (group < firstGroup) firstGroup = group;
+
+		if ((group > currentGroup) && (!foundNextGroup || (group < nextGroup)))
+		{
+			nextGroup = group;
+			foundNextGroup = true;
+		}
+	}
+
+	// ...or starting the next sweep from the first group.
+	return foundNextGroup ? nextGroup : firstGroup;
+}
+
+
+boolean URMSensorArray::selectDueGroup()
+{
+	unsigned long now = micros();
+
+	// Finding out whether any sensor is due...
+	boolean isAnySensorDue = false;
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		if (now - _triggerTimes[slot] >= _intervals[slot]) isAnySensorDue = true;
+	}
+
+	if (!isAnySensorDue) return false;
+
+	// ...and skipping the groups until we get to its one. This loop always ends, since 
+	// selectNextGroup() goes through all the groups.
+	for (;;)
+	{
+		for (byte slot = 0; slot < _sensorCount; slot++)
+		{
+			if ((_groups[slot] == _currentGroup) && (now - _triggerTimes[slot] >= _intervals[slot])) return true;
+		}
+
+		selectNextGroup();
+	}
+}
+
+unsigned long URMSensorArray::computeInterval(byte slot, unsigned long distance)
+{
+	if (distance == URM_INVALID_VALUE) return _maxInterval;
+
+	// The target is moving fast: it needs every measure it can get.
+	unsigned long previousDistance = _distances[slot];
+	if ((_speedThreshold != 0) && (previousDistance != URM_INVALID_VALUE))
+	{
+		unsigned long change = (distance > previousDistance) ? 
+			(distance - previousDistance) : (previousDistance - distance);
+
+		// change / elapsed >= threshold, with the time in milliseconds so nothing overflows.
+		unsigned long elapsed = (_lastTriggerTime - _triggerTimes[slot]) / 1000;
+		if (change * 1000 >= _speedThreshold * elapsed) return _minInterval;
+	}
+
+	if (distance <= _nearDistance) return _minInterval;
+	if (distance >= _farDistance) return _maxInterval;
+
+	// Proportionally between the near and far distances, in 1/256 parts.
+	unsigned long fraction = ((distance - _nearDistance) << 8) / (_farDistance - _nearDistance);
+	return _minInterval + ((_maxInterval - _minInterval) >> 8) * fraction;
+}
+
+
+boolean URMSensorArray::isPlausible(byte slot, unsigned long distance)
+{
+	// Nothing to compare with, or to check: a missing echo can't come from another sensor.
+	if (distance == URM_INVALID_VALUE) return true;
+
+	unsigned long acceptedDistance = _acceptedDistances[slot];
+
+	if ((acceptedDistance != URM_INVALID_VALUE) && (distance < acceptedDistance) && 
+		(_rejectCounts[slot] < _maxRejectCount))
+	{
+		// The time is in milliseconds, and limited to a minute, so nothing overflows.
+		unsigned long elapsed = (_lastTriggerTime - _acceptedTimes[slot]) / 1000;
+		if (elapsed > 60000) elapsed = 60000;
+
+		unsigned long maxChange = URM_ARRAY_PLAUSIBILITY_TOLERANCE + (_maxClosingSpeed * elapsed) / 1000;
+
+		if (acceptedDistance - distance > maxChange)
+		{
+			_rejectCounts[slot]++;
+			return false;
+		}
+	}
+
+	_acceptedDistances[slot] = distance;
+	_acceptedTimes[slot] = _lastTriggerTime;
+	_rejectCounts[slot] = 0;
+	return true;
+}
+
+unsigned int URMSensorArray::nextJitter()
+{
+	if (_maxJitter == 0) return 0;
+
+	// 16-bit xorshift: a few shifts, and good enough to spread the triggers.
+	uint16_t x = _randomState;
+	x ^= x << 7;
+	x ^= x >> 9;
+	x ^= x << 8;
+	_randomState = x;
+
+	// Scaling to 0..maxJitter without division.
+	return ((unsigned long)x * _maxJitter) >> 16;
+}
+
+
+
+#ifdef URM_USE_PORTS_DIRECTLY
+
+void URMSensorArray::prepareSampling()
+{
+	_echoPortCount = 0;
+	_earliestTimeout = URM_TIME_MAX;
+
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		_echoPortIndices[slot] = URM_ARRAY_INVALID_SLOT;
+
+		URMSensor* sensor = _sensors[slot];
+		if ((_groups[slot] != _currentGroup) || !sensor->isAttached() || 
+			(sensor->getEchoMode() != EchoPolling)) continue;
+
+		// Looking for the port among the ones we already have...
+		byte portIndex = 0;
+		while ((portIndex < _echoPortCount) && (_echoPorts[portIndex] != sensor->_echoIN)) portIndex++;
+
+		// ...and adding it if it's not there. The snapshot is taken before the trigger, so
+		// the first pulse edge will be seen as a change even if it comes very quickly.
+		if (portIndex == _echoPortCount)
+		{
+			_echoPorts[portIndex] = sensor->_echoIN;
+			_echoSnapshots[portIndex] = *sensor->_echoIN;
+			_echoPortCount++;
+		}
+
+		_echoPortIndices[slot] = portIndex;
+
+		// The pulse starts after the trigger, so its width can't exceed the limit earlier either.
+		if (sensor->_timeoutForPulseStart < _earliestTimeout) _earliestTimeout = sensor->_timeoutForPulseStart;
+		if (sensor->_maxPulseDuration < _earliestTimeout) _earliestTimeout = sensor->_maxPulseDuration;
+		if (sensor->_maxRangeDuration < _earliestTimeout) _earliestTimeout = sensor->_maxRangeDuration;
+	}
+}
+
+void URMSensorArray::sampleGroup()
+{
+	URMTime now = urmNow();
+
+	// Until the earliest timeout, the state of a sensor can only be changed by the edge 
+	// on its ECHO pin.
+	boolean timeoutsArePossible = (urmElapsed(now, _samplingStartTime) > _earliestTimeout);
+
+	// From now on they are possible till the end of the group, even after URMTime wraps around.
+	if (timeoutsArePossible) _earliestTimeout = 0;
+
+	// One read for every port...
+	URMPortMask changes[URM_ARRAY_MAX_SENSORS];
+	for (byte portIndex = 0; portIndex < _echoPortCount; portIndex++)
+	{
+		URMPortMask snapshot = *_echoPorts[portIndex];
+		changes[portIndex] = snapshot ^ _echoSnapshots[portIndex];
+		_echoSnapshots[portIndex] = snapshot;
+	}
+
+	// ...and one pass through the sensors with the same timestamp for all of them.
+	for (byte slot = 0; slot < _sensorCount; slot++)
+	{
+		byte portIndex = _echoPortIndices[slot];
+		if ((_groups[slot] != _currentGroup) || (portIndex == URM_ARRAY_INVALID_SLOT)) continue;
+
+		URMSensor* sensor = _sensors[slot];
+		URMPortMask echoMask = sensor->_echoMask;
+
+	#ifdef URM_USE_INSTRUMENTATION
+		// Every sampling is the refresh for the sensor, even if its state is not updated.
+		if (sensor->isMeasuring()) sensor->recordPoll(now);
+	#endif
+
+		if ((changes[portIndex] & echoMask) || timeoutsArePossible)
+		{
+			sensor->updateState(((_echoSnapshots[portIndex] & echoMask) != 0) ? HIGH : LOW, now);
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,507 @@
+#ifndef URMSENSORARRAY_H
+#define URMSENSORARRAY_H
+
+#include "URMSensor.h"
+
+/**
+ * Maximal number of sensors in one URMSensorArray.
+ */
+#define URM_ARRAY_MAX_SENSORS 8
+
+/**
+ * Value returned by URMSensorArray::addSensor() when the sensor could not be added.
+ */
+#define URM_ARRAY_INVALID_SLOT 0xFF
+
+/**
+ * Default minimal time between triggering two consecutive groups of sensors, in microseconds.
+ * It gives echoes from the previous group some time to fade away.
+ */
+#define URM_ARRAY_DEFAULT_GUARD_TIME 10000 // us
+
+/**
+ * Default distances used by the adaptive sampling (see URMSensorArray::setAdaptiveSampling()).
+ * The sensors that see anything closer than the near distance are fired as often as possible,
+ * and the ones that see nothing closer than the far distance are fired as rarely as possible.
+ */
+#define URM_ARRAY_DEFAULT_NEAR_DISTANCE 30 // cm
+#define URM_ARRAY_DEFAULT_FAR_DISTANCE 300 // cm
+
+/**
+ * Default speed of the target that makes the adaptive sampling fire the sensor as often as possible,
+ * regardless of the distance.
+ */
+#define URM_ARRAY_DEFAULT_SPEED_THRESHOLD 50 // cm/s
+
+/**
+ * Default number of echoes in a row the cross-talk rejection may drop before accepting the new
+ * distance anyway (see URMSensorArray::setCrossTalkRejection()).
+ */
+#define URM_ARRAY_DEFAULT_MAX_REJECT_COUNT 3
+
+/**
+ * Number of finished measures URMSensorArray keeps for its dispatch() (must be a power of 2, and one entry
+ * is always kept free). It's enough for every sensor of the full array to finish two measures between
+ * the calls. Every entry takes 6 bytes of RAM.
+ */
+#define URM_ARRAY_DISPATCH_QUEUE_SIZE 16
+
+/**
+ * Finished measure waiting for URMSensorArray::dispatch().
+ */
+struct URMArrayCompletion
+{
+	unsigned long distance;
+	byte slot;
+	byte status;
+};
+
+/**
+ * Distance the target may get closer by between two measures regardless of its speed, so
+ * the noise of the measure is not taken for cross-talk.
+ */
+#define URM_ARRAY_PLAUSIBILITY_TOLERANCE 5 // cm
+
+/**
+ * Finds the group fired after the given one: the smallest group number greater than it, or the
+ * smallest one at all when the sweep is over. Shared by URMSensorArray and URMPackedArray.
+ *
+ * @param groups Group numbers of the sensors.
+ *
+ * @param count Number of the sensors (at least one).
+ *
+ * @param currentGroup Number of the group fired last.
+ *
+ * @return Number of the next group. It is not greater than currentGroup if a new sweep begins.
+ */
+byte urmSelectNextGroup(const byte* groups, byte count, byte currentGroup);
+
+/**
+ * A class that drives several sensors, so you don't have to do it by hand in your loop() function.
+ *
+ * Every sensor is placed in a slot and belongs to a group. The array fires the groups one after
+ * another in ascending order of their numbers; all sensors of the same group are fired at the
+ * same time, so the whole sweep takes as much time as many groups there are. Put in the same group
+ * only the sensors that can't hear each other (for example, looking in opposite directions).
+ *
+ * @author Andrey A. Vasenev
+ */
+class URMSensorArray
+{
+	public:
+		/**
+		 * Constructor.
+		 */
+		URMSensorArray();
+
+
+		// ====== Configuration =======================================================================================
+
+		/**
+		 * Adds the sensor to the array. The sensor must be attach()'d before calling update(), and
+		 * you should not start the measures on it by yourself after adding it.
+		 *
+		 * @param sensor The sensor to add.
+		 *
+		 * @param group Number of the group the sensor will belong to.
+		 *
+		 * @return Number of the slot the sensor was put in, or URM_ARRAY_INVALID_SLOT if the array
+		 * already contains URM_ARRAY_MAX_SENSORS sensors.
+		 */
+		byte addSensor(URMSensor& sensor, byte group);
+
+		/**
+		 * Adds the sensor to the array in its own group, so it will be fired alone after all
+		 * sensors added before it.
+		 *
+		 * @param sensor The sensor to add.
+		 *
+		 * @return Number of the slot the sensor was put in, or URM_ARRAY_INVALID_SLOT if the array
+		 * already contains URM_ARRAY_MAX_SENSORS sensors.
+		 */
+		byte addSensor(URMSensor& sensor)
+		{
+			return addSensor(sensor, _sensorCount);
+		}
+
+		/**
+		 * Moves the sensor to another group. The change will take effect at the next sweep.
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @param group Number of the new group.
+		 */
+		void setGroup(byte slot, byte group)
+		{
+			if (slot < _sensorCount) _groups[slot] = group;
+		}
+
+		/**
+		 * Sets the minimal time between triggering two consecutive groups of sensors. The next
+		 * group is also never fired before the current one finished its measure.
+		 *
+		 * @param guardTime Time in microseconds.
+		 */
+		void setGuardTime(unsigned long guardTime)
+		{
+			_guardTime = guardTime;
+		}
+
+		/**
+		 * Turns on the adaptive sampling: instead of firing every group in turn, the array fires
+		 * only the groups that have a sensor due for the next measure. Every sensor is due after
+		 * the interval computed from its latest result:
+		 *
+		 * - minInterval if the distance is changing faster than setAdaptiveSpeedThreshold() says,
+		 *   or if it is less than the near distance (see setAdaptiveDistances());
+		 * - maxInterval if the distance is more than the far distance, or if the measure failed;
+		 * - proportionally between them otherwise.
+		 *
+		 * So the close and moving obstacles get most of the measures, and the far static walls get
+		 * the rest. Note that getSweepCount() then counts the passes through the groups, where some
+		 * of the groups may have been skipped.
+		 *
+		 * @param minInterval Minimal time between two measures of the same sensor, in microseconds.
+		 *
+		 * @param maxInterval Maximal time between two measures of the same sensor, in microseconds,
+		 * or 0 to turn the adaptive sampling off.
+		 */
+		void setAdaptiveSampling(unsigned long minInterval, unsigned long maxInterval)
+		{
+			_minInterval = minInterval;
+			_maxInterval = (maxInterval < minInterval) ? minInterval : maxInterval;
+		}
+
+		/**
+		 * Sets the distances the adaptive sampling compares the results with (see setAdaptiveSampling()).
+		 *
+		 * @param nearDistance Distance in centimeters, below which the sensor is fired every minInterval.
+		 *
+		 * @param farDistance Distance in centimeters, above which the sensor is fired every maxInterval.
+		 */
+		void setAdaptiveDistances(unsigned long nearDistance, unsigned long farDistance)
+		{
+			_nearDistance = nearDistance;
+			_farDistance = (farDistance <= nearDistance) ? (nearDistance + 1) : farDistance;
+		}
+
+		/**
+		 * Sets the speed of the distance change that makes the adaptive sampling fire the sensor every
+		 * minInterval, however far the target is (see setAdaptiveSampling()).
+		 *
+		 * @param speedThreshold Speed in cm/s, or 0 to ignore the speed.
+		 */
+		void setAdaptiveSpeedThreshold(unsigned long speedThreshold)
+		{
+			_speedThreshold = speedThreshold;
+		}
+
+		/**
+		 * Adds a random delay (from 0 to maxJitter) to the guard time before firing every group.
+		 * Echoes from the previous groups (or from the sensors of other devices) then come
+		 * at different times in every measure, instead of repeating the same wrong distance, so
+		 * setCrossTalkRejection() can tell them from the real targets. 
+		 *
+		 * @param maxJitter Maximal delay in microseconds, or 0 to fire the groups at fixed times.
+		 */
+		void setTriggerJitter(unsigned int maxJitter)
+		{
+			_maxJitter = maxJitter;
+
+			// Any non-zero value will do, but the devices started at different times get different ones.
+			_randomState = (uint16_t)micros() | 1;
+		}
+
+		/**
+		 * Turns on the cross-talk rejection. The echo that comes earlier than physically possible
+		 * (the distance got shorter than the target could move since the latest accepted measure)
+		 * is considered to be sent by another sensor, and the measure is reported with StatusRejected.
+		 * If the same thing happens for several measures in a row, it is a new obstacle in front
+		 * of the sensor, and the distance is accepted. With the adaptive sampling, the rejected sensor
+		 * is measured at minInterval, so the new obstacle is confirmed as soon as possible.
+		 *
+		 * The array checks the measure after the sensor has finished it, so the filter of the sensor
+		 * (see URMSensor::setFilter()) still gets the rejected pulses. Take the distances from
+		 * getDistance() when the cross-talk matters, not from URMSensor::getFilteredDistance().
+		 *
+		 * @param maxClosingSpeed Maximal speed the targets can approach the sensors at, in cm/s,
+		 * or 0 to turn the rejection off.
+		 *
+		 * @param maxRejectCount Maximal number of measures in a row that can be rejected.
+		 */
+		void setCrossTalkRejection(unsigned int maxClosingSpeed, byte maxRejectCount = URM_ARRAY_DEFAULT_MAX_REJECT_COUNT)
+		{
+			_maxClosingSpeed = maxClosingSpeed;
+			_maxRejectCount = maxRejectCount;
+		}
+
+		/**
+		 * Makes all sensors of the array take the speed of sound from the given environment
+		 * (see URMSensor::setEnvironment()), so updating the environment reconfigures all of them.
+		 *
+		 * @param environment The environment to use, or NULL to go back to the sensors' own constants.
+		 */
+		void setEnvironment(URMEnvironment* environment)
+		{
+			for (byte slot = 0; slot < _sensorCount; slot++) _sensors[slot]->setEnvironment(environment);
+		}
+
+		/**
+		 * Makes the sensor pass its results through the given filter (see URMSensor::setFilter()).
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @param filter The filter to use, or NULL to stop filtering. Every sensor needs its own filter.
+		 */
+		void setFilter(byte slot, URMFilter* filter)
+		{
+			if (slot < _sensorCount) _sensors[slot]->setFilter(filter);
+		}
+
+		/**
+		 * Retrieves the number of sensors in the array.
+		 */
+		byte getSensorCount()
+		{
+			return _sensorCount;
+		}
+
+		/**
+		 * Retrieves the sensor placed in the given slot.
+		 *
+		 * @param slot Number of the slot. Must be less than getSensorCount().
+		 */
+		URMSensor& getSensor(byte slot)
+		{
+			return *_sensors[slot];
+		}
+
+
+
+		// ====== Measuring ===========================================================================================
+
+		/**
+		 * Refreshes the state of all sensors of the current group, and fires the next group when
+		 * the current one is finished. Call this method in your loop() function as often as you can.
+		 */
+		void update();
+
+		/**
+		 * Retrieves the latest distance measured by the sensor. The value stays the same until
+		 * the sensor finishes its next measure.
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return Distance in centimeters, or URM_INVALID_VALUE if the latest measure failed
+		 * or was not done yet.
+		 */
+		unsigned long getDistance(byte slot)
+		{
+			return (slot < _sensorCount) ? _distances[slot] : URM_INVALID_VALUE;
+		}
+
+		/**
+		 * Retrieves the filtered distance measured by the sensor (see URMSensor::getFilteredDistance()).
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return Distance in centimeters, or URM_INVALID_VALUE if the sensor has no filter
+		 * or no measure succeeded yet.
+		 */
+		unsigned long getFilteredDistance(byte slot)
+		{
+			return (slot < _sensorCount) ? _sensors[slot]->getFilteredDistance() : URM_INVALID_VALUE;
+		}
+
+		/**
+		 * Retrieves the result of the latest measure done by the sensor (see URMSensor::getStatus()).
+		 * The value stays the same until the sensor finishes its next measure.
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return One of URMStatus values.
+		 */
+		byte getStatus(byte slot)
+		{
+			return (slot < _sensorCount) ? _statuses[slot] : (byte)StatusNone;
+		}
+
+		/**
+		 * Retrieves the time after which the sensor will be fired again by the adaptive sampling
+		 * (see setAdaptiveSampling()).
+		 *
+		 * @param slot Number of the slot containing the sensor.
+		 *
+		 * @return Time in microseconds, or 0 if the sensor will be fired as soon as possible.
+		 */
+		unsigned long getInterval(byte slot)
+		{
+			return (slot < _sensorCount) ? _intervals[slot] : 0;
+		}
+
+		/**
+		 * Retrieves the number of completed sweeps. Every sensor of the array has done one measure
+		 * during each sweep, so you can use this value to detect that all distances were updated.
+		 */
+		unsigned long getSweepCount()
+		{
+			return _sweepCount;
+		}
+
+		/**
+		 * Sets the function that dispatch() will call for every sensor when it finishes the measure.
+		 * The slot number is passed to it as the identifier.
+		 *
+		 * @param handler The function to call, or NULL to stop calling it.
+		 */
+		void onMeasurementComplete(URMMeasurementHandler handler);
+
+		/**
+		 * Does the same as update(), and then calls the function set by onMeasurementComplete()
+		 * once for every measure finished since the previous call, in the order they were finished.
+		 * The measures finished by update() called elsewhere are kept till then too, up to
+		 * (URM_ARRAY_DISPATCH_QUEUE_SIZE - 1) of them. Call this method in your loop() function
+		 * instead of update().
+		 */
+		void dispatch();
+
+		/**
+		 * Retrieves the number of finished measures that were not passed to the handler because
+		 * dispatch() was not called in time. The counter wraps around after 255.
+		 */
+		byte getDroppedDispatchCount()
+		{
+			return _completions.getDroppedCount();
+		}
+
+	private:
+		URMSensor* _sensors[URM_ARRAY_MAX_SENSORS];
+		byte _groups[URM_ARRAY_MAX_SENSORS];
+		unsigned long _distances[URM_ARRAY_MAX_SENSORS];
+		byte _statuses[URM_ARRAY_MAX_SENSORS];
+
+		byte _sensorCount;
+
+		byte _currentGroup;
+		boolean _groupIsMeasuring;
+
+		unsigned long _guardTime;
+		unsigned long _lastTriggerTime;
+
+		unsigned long _sweepCount;
+
+		// Adaptive sampling settings; _maxInterval is 0 when it is off.
+		unsigned long _minInterval;
+		unsigned long _maxInterval;
+		unsigned long _nearDistance;
+		unsigned long _farDistance;
+		unsigned long _speedThreshold;
+
+		// Time the sensor was fired at, and the interval after which it will be due again.
+		unsigned long _triggerTimes[URM_ARRAY_MAX_SENSORS];
+		unsigned long _intervals[URM_ARRAY_MAX_SENSORS];
+
+		// Delay added to the guard time before firing the next group, and the state of the xorshift
+		// generator it is taken from.
+		unsigned int _maxJitter;
+		unsigned int _currentJitter;
+		uint16_t _randomState;
+
+		// Cross-talk rejection settings; _maxClosingSpeed is 0 when it is off.
+		unsigned int _maxClosingSpeed;
+		byte _maxRejectCount;
+
+		// The latest accepted distance with its time, and the number of measures rejected after it.
+		unsigned long _acceptedDistances[URM_ARRAY_MAX_SENSORS];
+		unsigned long _acceptedTimes[URM_ARRAY_MAX_SENSORS];
+		byte _rejectCounts[URM_ARRAY_MAX_SENSORS];
+
+		URMMeasurementHandler _measurementHandler;
+
+		// The measures finished while the handler was set, waiting for dispatch().
+		URMRingBuffer<URMArrayCompletion, URM_ARRAY_DISPATCH_QUEUE_SIZE> _completions;
+
+	#ifdef URM_USE_PORTS_DIRECTLY
+		// Input registers of the ports the ECHO pins of the current group are connected to,
+		// and their states at the previous sampling.
+		URMPortRegister* _echoPorts[URM_ARRAY_MAX_SENSORS];
+		URMPortMask _echoSnapshots[URM_ARRAY_MAX_SENSORS];
+		byte _echoPortCount;
+
+		// Index of the port in _echoPorts for every slot, or URM_ARRAY_INVALID_SLOT if the sensor
+		// does not work in polling mode and refreshes its state by itself.
+		byte _echoPortIndices[URM_ARRAY_MAX_SENSORS];
+
+		// No sensor of the current group can time out earlier than this time after the trigger
+		// (in the units of URMTime, and counted from _samplingStartTime).
+		URMTime _earliestTimeout;
+		URMTime _samplingStartTime;
+
+		/**
+		 * Remembers the ports of the current group and their states before it is fired.
+		 */
+		void prepareSampling();
+
+		/**
+		 * Reads every port of the current group once, and refreshes the state of the sensors
+		 * whose ECHO pins have changed.
+		 */
+		void sampleGroup();
+	#endif
+
+		/**
+		 * Fires all sensors of the current group.
+		 */
+		void startGroup();
+
+		/**
+		 * Sends one trigger pulse to all sensors of the current group that are ready to start
+		 * the measure. With URM_USE_PORTS_DIRECTLY, the pulse is set and cleared with one write
+		 * for every port the TRIG pins are connected to.
+		 */
+		void triggerGroup();
+
+		/**
+		 * Checks whether all sensors of the current group finished the measure, and saves
+		 * the distances if they did.
+		 */
+		boolean finishGroup();
+
+		/**
+		 * Selects the group that will be fired after the current one.
+		 */
+		void selectNextGroup();
+
+		/**
+		 * Selects the first group that has a sensor due for the next measure, starting from
+		 * the current one.
+		 *
+		 * @return false if no sensor is due yet.
+		 */
+		boolean selectDueGroup();
+
+		/**
+		 * Computes the time after which the sensor should be fired again.
+		 *
+		 * @param slot Number of the slot containing the sensor. Its previous result and time
+		 * must still be there.
+		 *
+		 * @param distance The new result.
+		 */
+		unsigned long computeInterval(byte slot, unsigned long distance);
+
+		/**
+		 * Checks whether the target could get to the new distance since the latest accepted measure,
+		 * and remembers the distance if it is accepted.
+		 *
+		 * @return false if the distance should be rejected.
+		 */
+		boolean isPlausible(byte slot, unsigned long distance);
+
+		/**
+		 * Takes the next random delay for setTriggerJitter().
+		 */
+		unsigned int nextJitter();
+};
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef URMSENSORT_H
+#define URMSENSORT_H
+
+#include "URMSensor.h"
+
+/**
+ * Sensor profiles for URMSensorT. A profile holds the same constants you would pass to
+ * URMSensor::attach(), so you can make your own profile for other sensors.
+ */
+struct URM37Profile
+{
+	static const int usPerCm = URM37_US_PER_CM;
+	static const unsigned long timeoutForPulseStart = URM37_TIMEOUT_FOR_PULSE_START;
+	static const unsigned long maxPulseDuration = URM37_MAX_PULSE_WIDTH;
+	static const byte trigActiveState = URM37_TRIG_ACTIVE_STATE;
+	static const byte echoActiveState = URM37_ECHO_ACTIVE_STATE;
+	static const unsigned int trigPulseWidth = URM37_TRIG_PULSE_WIDTH;
+};
+
+struct HC_SR04Profile
+{
+	static const int usPerCm = HC_SR04_US_PER_CM;
+	static const unsigned long timeoutForPulseStart = HC_SR04_TIMEOUT_FOR_PULSE_START;
+	static const unsigned long maxPulseDuration = HC_SR04_MAX_PULSE_WIDTH;
+	static const byte trigActiveState = HC_SR04_TRIG_ACTIVE_STATE;
+	static const byte echoActiveState = HC_SR04_ECHO_ACTIVE_STATE;
+	static const unsigned int trigPulseWidth = HC_SR04_TRIG_PULSE_WIDTH;
+};
+
+/**
+ * Access to the pin known at compile time. On ATmega328-based boards (Uno, Nano, Duemilanove, etc.)
+ * the port registers are resolved by the compiler, so reading and writing the pin takes a single
+ * instruction. On other boards digitalRead() and digitalWrite() are used.
+ */
+template <byte pin>
+struct URMPin
+{
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__) || \
+	defined(__AVR_ATmega88__) || defined(__AVR_ATmega48__)
+	static_assert(pin < 20, "There are only 20 digital pins on this board");
+
+	static const byte mask = 1 << ((pin < 8) ? pin : ((pin < 14) ? (pin - 8) : (pin - 14)));
+
+	static volatile uint8_t& pinRegister() { return (pin < 8) ? PIND : ((pin < 14) ? PINB : PINC); }
+	static volatile uint8_t& portRegister() { return (pin < 8) ? PORTD : ((pin < 14) ? PORTB : PORTC); }
+	static volatile uint8_t& ddrRegister() { return (pin < 8) ? DDRD : ((pin < 14) ? DDRB : DDRC); }
+
+	static byte read() { return ((pinRegister() & mask) != 0) ? HIGH : LOW; }
+
+	static void write(byte value)
+	{
+		if (value == HIGH) portRegister() |= mask;
+		else portRegister() &= ~mask;
+	}
+
+	static void setOutput() { ddrRegister() |= mask; }
+	static void setInput() { ddrRegister() &= ~mask; portRegister() &= ~mask; }
+#else
+	static byte read() { return digitalRead(pin); }
+	static void write(byte value) { digitalWrite(pin, value); }
+	static void setOutput() { pinMode(pin, OUTPUT); }
+	static void setInput() { pinMode(pin, INPUT); }
+#endif
+};
+
+/**
+ * A class representing single ultrasonic ranging sensor, with pins and sensor constants known at
+ * compile time. It works just like URMSensor, but does not store pins and constants in RAM (it takes
+ * 9 bytes per instance), and the compiler can optimize the state machine much better. Since the pins
+ * are fixed, there's nothing to detach, and attach() only has to initialize them.
+ *
+ * Example:
+ *
+ *     URMSensorT<9, 10, HC_SR04Profile> sensor;
+ *
+ * @author Andrey A. Vasenev
+ */
+template <byte TrigPin, byte EchoPin, class Profile>
+class URMSensorT
+{
+	public:
+		/**
+		 * Constructor.
+		 */
+		URMSensorT()
+		{
+			_currentState = Idle;
+		}
+
+		/**
+		 * Initializes the pins. You should call this method inside the setup() function of your sketch.
+		 */
+		void attach()
+		{
+			Trig::write(idleState(Profile::trigActiveState));
+			Trig::setOutput();
+			Echo::setInput();
+		}
+
+
+
+		// ====== Methods for asynchronous data reading ===============================================================
+
+		/**
+		 * Starts the measure.
+		 */
+		void startMeasure()
+		{
+			// Ignoring the call if this instance already started measuring the distance.
+			if (isMeasuring()) return;
+
+			// Failing the measure if the ECHO pin is not in IDLE state.
+			if (Echo::read() == Profile::echoActiveState)
+			{
+				_currentState = Idle;
+				return;
+			}
+
+			Trig::write(Profile::trigActiveState);
+			delayMicroseconds(Profile::trigPulseWidth);
+			Trig::write(idleState(Profile::trigActiveState));
+
+			_currentState = WaitingForPulse;
+			_currentDuration = 0;
+			_startMeasureTime = micros();
+		}
+
+		/**
+		 * Indicates whether this instance is currently doing the measure.
+		 *
+		 * @return true if this instance currently measures the distance.
+		 */
+		boolean isMeasuring()
+		{
+			return (_currentState == WaitingForPulse || _currentState == Measuring);
+		}
+
+		/**
+		 * Interrupts the measure.
+		 */
+		void interruptMeasure()
+		{
+			_currentState = Idle;
+		}
+
+		/**
+		 * Refreshes the state of this instance. See URMSensor::refreshState().
+		 */
+		void refreshState()
+		{
+			if (!isMeasuring()) return;
+
+			boolean echoIsActive = (Echo::read() == Profile::echoActiveState);
+			unsigned long now = micros();
+
+			if (_currentState == WaitingForPulse)
+			{
+				if (echoIsActive)
+				{
+					_currentState = Measuring;
+					_currentDuration = 0;
+					_startMeasureTime = now;
+				}
+				else if (now - _startMeasureTime > Profile::timeoutForPulseStart)
+				{
+					_currentState = Idle;
+				}
+			}
+			else
+			{
+				_currentDuration = now - _startMeasureTime;
+
+				if (!echoIsActive) _currentState = FinishedMeasure;
+				else if (_currentDuration > Profile::maxPulseDuration) _currentState = Idle;
+			}
+		}
+
+		/**
+		 * Indicates whether this instance finished the measure. See URMSensor::finishedMeasure().
+		 *
+		 * @return true if this instance is not currently measuring the distance.
+		 */
+		boolean finishedMeasure()
+		{
+			refreshState();
+			return !isMeasuring();
+		}
+
+		/**
+		 * Simply retrieves the value from the previous measure.
+		 *
+		 * @return Distance from the previous measure, or URM_INVALID_VALUE if
+		 * the previous measure failed or if this instance is currently measuring
+		 * the distance.
+		 */
+		unsigned long getMeasuredDistance()
+		{
+			if (_currentState != FinishedMeasure) return URM_INVALID_VALUE;
+
+			// The divisor is a constant, so the compiler can replace the division with multiplication.
+			return _currentDuration / Profile::usPerCm;
+		}
+
+
+
+		// ====== Synchronous distance reading ========================================================================
+
+		/**
+		 * Synchronously gets the distance in front of the sensor. See URMSensor::measureDistance().
+		 *
+		 * @return Distance in front of the sensor in centimeters, or URM_INVALID_VALUE
+		 * in case of failure.
+		 */
+		unsigned long measureDistance()
+		{
+			return measureDistance(yield);
+		}
+
+		/**
+		 * Synchronously gets the distance, calling the given function while waiting for the sensor.
+		 * See URMSensor::measureDistance(URMYieldHandler).
+		 *
+		 * @return Distance in front of the sensor in centimeters, or URM_INVALID_VALUE
+		 * in case of failure.
+		 */
+		unsigned long measureDistance(URMYieldHandler yieldHandler)
+		{
+			startMeasure();
+
+			while (!finishedMeasure())
+			{
+				if (yieldHandler != NULL) yieldHandler();
+			}
+
+			return getMeasuredDistance();
+		}
+
+
+
+		// ====== Debugging-related methods ===========================================================================
+
+		/**
+		 * Retrieves current state of this instance. May be useful for debugging
+		 * any sensor- or library-related issues.
+		 */
+		byte getState()
+		{
+			return _currentState;
+		}
+
+	private:
+		typedef URMPin<TrigPin> Trig;
+		typedef URMPin<EchoPin> Echo;
+
+		static byte idleState(byte activeState)
+		{
+			return (activeState == HIGH) ? LOW : HIGH;
+		}
+
+		unsigned long _startMeasureTime;
+		unsigned long _currentDuration;
+
+		byte _currentState;
+};
+
+/**
+ * Shortcuts for the sensors supported out of the box.
+ */
+template <byte TrigPin, byte EchoPin>
+using URM37T = URMSensorT<TrigPin, EchoPin, URM37Profile>;
+
+template <byte TrigPin, byte EchoPin>
+using HC_SR04T = URMSensorT<TrigPin, EchoPin, HC_SR04Profile>;
+
+#endif
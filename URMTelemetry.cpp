@@ -0,0 +1,141 @@
+#include "URMTelemetry.h"
+
+/**
+ * CRC-8 with the polynomial 0x07 and zero initial value (CRC-8/SMBUS). It is computed bit by bit,
+ * which is fast enough for 8 bytes and doesn't need a table in flash.
+ */
+static byte urmTelemetryCrc(const byte* data, byte length)
+{
+	byte crc = 0;
+
+	for (byte i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+
+		for (byte bit = 0; bit < 8; bit++)
+		{
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+		}
+	}
+
+	return crc;
+}
+
+URMTelemetry::URMTelemetry(Print& output) : _output(output)
+{
+	_hasRecord = false;
+
+	_frameLength = 0;
+	_framePosition = 0;
+
+	_previousTimestamp = 0;
+	_framesSinceTime = 0;
+	_hasTime = false;
+}
+
+boolean URMTelemetry::add(byte id, unsigned long timestamp, unsigned long pulseWidth, byte status)
+{
+	URMTelemetryRecord record;
+	record.timestamp = timestamp;
+	record.pulseWidth = (pulseWidth < URM_TELEMETRY_INVALID_WIDTH) ? pulseWidth : URM_TELEMETRY_INVALID_WIDTH;
+	record.id = id;
+	record.status = status;
+
+	return _records.push(record);
+}
+
+#ifdef URM_SAMPLE_BUFFER_SIZE
+byte URMTelemetry::addSamples(byte id, URMSensor& sensor)
+{
+	byte count = 0;
+	URMSample sample;
+
+	// The free space is checked first, so the sample is never taken from the sensor and then lost.
+	while ((_records.getCount() < URM_TELEMETRY_BUFFER_SIZE - 1) && sensor.readSample(sample))
+	{
+		add(id, sample);
+		count++;
+	}
+
+	return count;
+}
+#endif
+
+void URMTelemetry::flush()
+{
+	int space = _output.availableForWrite();
+
+	while (space > 0)
+	{
+		if ((_framePosition == _frameLength) && !buildNextFrame()) return;
+
+		byte count = _frameLength - _framePosition;
+		if (count > space) count = space;
+
+		_output.write(_frame + _framePosition, count);
+		_framePosition += count;
+		space -= count;
+	}
+}
+
+boolean URMTelemetry::buildNextFrame()
+{
+	if (!_hasRecord)
+	{
+		if (!_records.pop(_record)) return false;
+		_hasRecord = true;
+	}
+
+	// The delta must fit in 16 bits with its sign: the sensors of the same group finish in any order,
+	// so the timestamps may go back a little.
+	long delta = (long)(_record.timestamp - _previousTimestamp);
+
+	if (!_hasTime || (delta < -32768L) || (delta > 32767L) || (_framesSinceTime >= URM_TELEMETRY_TIME_INTERVAL))
+	{
+		// The record will be sent in the next frame, with zero delta.
+		beginFrame(URM_TELEMETRY_FRAME_TIME);
+		appendWord(_record.timestamp & 0xFFFF);
+		appendWord(_record.timestamp >> 16);
+		endFrame();
+
+		_previousTimestamp = _record.timestamp;
+		_framesSinceTime = 0;
+		_hasTime = true;
+
+		return true;
+	}
+
+	beginFrame(URM_TELEMETRY_FRAME_MEASUREMENT);
+	_frame[_frameLength++] = _record.id;
+	appendWord((uint16_t)(int16_t)delta);
+	appendWord(_record.pulseWidth);
+	_frame[_frameLength++] = _record.status;
+	endFrame();
+
+	_previousTimestamp = _record.timestamp;
+	_framesSinceTime++;
+	_hasRecord = false;
+
+	return true;
+}
+
+void URMTelemetry::beginFrame(byte type)
+{
+	_frame[0] = URM_TELEMETRY_SYNC;
+	_frame[1] = type;
+	_frameLength = 2;
+	_framePosition = 0;
+}
+
+void URMTelemetry::appendWord(uint16_t value)
+{
+	_frame[_frameLength++] = value & 0xFF;
+	_frame[_frameLength++] = value >> 8;
+}
+
+void URMTelemetry::endFrame()
+{
+	// The sync byte is not covered: it's the same in every frame.
+	_frame[_frameLength] = urmTelemetryCrc(_frame + 1, _frameLength - 1);
+	_frameLength++;
+}
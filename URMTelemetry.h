@@ -0,0 +1,168 @@
+#ifndef URMTELEMETRY_H
+#define URMTELEMETRY_H
+
+#include "URMSensor.h"
+
+/**
+ * Number of records URMTelemetry can hold before they are sent (must be a power of 2). Every record
+ * takes 8 bytes of RAM.
+ */
+#ifndef URM_TELEMETRY_BUFFER_SIZE
+	#define URM_TELEMETRY_BUFFER_SIZE 16
+#endif
+
+/**
+ * Number of measurement frames after which URMTelemetry repeats the time frame, so the decoder that
+ * lost a frame or started in the middle of the stream gets the right time again.
+ */
+#define URM_TELEMETRY_TIME_INTERVAL 32
+
+/**
+ * Framing of the telemetry stream. See extras/telemetry/README.md for the full description.
+ */
+#define URM_TELEMETRY_SYNC 0xA5
+
+#define URM_TELEMETRY_FRAME_MEASUREMENT 0x01
+#define URM_TELEMETRY_FRAME_TIME 0x02
+
+#define URM_TELEMETRY_MAX_FRAME_LENGTH 9
+
+/**
+ * Pulse width sent for the failed measures (and the pulses that don't fit in 16 bits).
+ */
+#define URM_TELEMETRY_INVALID_WIDTH 0xFFFF
+
+/**
+ * Single measure waiting to be sent.
+ */
+struct URMTelemetryRecord
+{
+	unsigned long timestamp;
+	uint16_t pulseWidth;
+	byte id;
+	byte status;
+};
+
+/**
+ * A class that streams the raw results of the measures in a compact binary format, so every measure
+ * of an array can be recorded at full rate and analyzed on a PC (extras/telemetry has the decoder).
+ * Each measure takes 9 bytes on the wire: at 115200 baud that is over 1000 measures per second,
+ * with no text formatting at all.
+ *
+ * The records are kept in the ring buffer, and flush() only writes as many bytes as the output
+ * can take without waiting, so it never blocks loop(). The output must report its free space
+ * with availableForWrite() (HardwareSerial and most USB serial ports do).
+ *
+ * @author Andrey A. Vasenev
+ */
+class URMTelemetry
+{
+	public:
+		/**
+		 * Constructor.
+		 *
+		 * @param output Where to send the frames, usually Serial.
+		 */
+		URMTelemetry(Print& output);
+
+		/**
+		 * Queues the result of the measure.
+		 *
+		 * @param id Number of the sensor, for example the slot in URMSensorArray.
+		 *
+		 * @param timestamp Time of the measure, as returned by micros().
+		 *
+		 * @param pulseWidth Width of the pulse in microseconds, or URM_INVALID_VALUE if the measure failed.
+		 *
+		 * @param status One of URMStatus values.
+		 *
+		 * @return true if the record was queued, or false if the buffer is full.
+		 */
+		boolean add(byte id, unsigned long timestamp, unsigned long pulseWidth, byte status);
+
+		/**
+		 * Queues the sample taken from the sample buffer of the sensor.
+		 *
+		 * @return true if the record was queued, or false if the buffer is full.
+		 */
+		boolean add(byte id, const URMSample& sample)
+		{
+			return add(id, sample.timestamp, sample.pulseWidth, sample.status);
+		}
+
+	#ifdef URM_SAMPLE_BUFFER_SIZE
+		/**
+		 * Moves the samples from the sample buffer of the sensor (see URM_SAMPLE_BUFFER_SIZE), as many
+		 * as there is room for.
+		 *
+		 * @return Number of samples moved.
+		 */
+		byte addSamples(byte id, URMSensor& sensor);
+	#endif
+
+		/**
+		 * Writes as many queued bytes as the output can take without blocking. Call this method
+		 * in your loop() function as often as you can.
+		 */
+		void flush();
+
+		/**
+		 * Retrieves the number of records waiting to be sent.
+		 */
+		byte getPendingCount()
+		{
+			return _records.getCount() + (_hasRecord ? 1 : 0);
+		}
+
+		/**
+		 * Retrieves the number of records lost because the buffer was full. The counter wraps around
+		 * after 255.
+		 */
+		byte getDroppedCount()
+		{
+			return _records.getDroppedCount();
+		}
+
+	private:
+		Print& _output;
+
+		URMRingBuffer<URMTelemetryRecord, URM_TELEMETRY_BUFFER_SIZE> _records;
+
+		// The record taken from the buffer, whose frame is not built yet (it waits for the time frame).
+		URMTelemetryRecord _record;
+		boolean _hasRecord;
+
+		// The frame being sent.
+		byte _frame[URM_TELEMETRY_MAX_FRAME_LENGTH];
+		byte _frameLength;
+		byte _framePosition;
+
+		// Time the deltas of measurement frames are counted from.
+		unsigned long _previousTimestamp;
+		byte _framesSinceTime;
+		boolean _hasTime;
+
+		/**
+		 * Builds the frame for the next record.
+		 *
+		 * @return false if there are no records to send.
+		 */
+		boolean buildNextFrame();
+
+		/**
+		 * Puts the sync byte and the type into the frame.
+		 */
+		void beginFrame(byte type);
+
+		/**
+		 * Puts the 16-bit value into the frame, lower byte first.
+		 */
+		void appendWord(uint16_t value);
+
+		/**
+		 * Finishes the frame with its CRC.
+		 */
+		void endFrame();
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef URMTIME_H
+#define URMTIME_H
+
+#include "URMHal.h"
+
+/**
+ * Time base of the measures. By default it is micros(), and URMTime is the same unsigned long.
+ * With URM_USE_TICK_TIMING it is the free-running 16-bit counter of Timer1, and URMTime is
+ * the 16-bit number of its ticks, URM_US_PER_TICK microseconds each:
+ * - urmNow() reads the counter in a few cycles, while micros() takes a few microseconds on AVR;
+ * - the state machine only does 16-bit arithmetic, and its times take half the RAM.
+ *
+ * The counter wraps around every 65536 ticks, so the times must always be subtracted with
+ * urmElapsed() (it is wraparound-safe as long as less than one period has passed), and every
+ * timeout must be shorter than the period. The conversions from microseconds saturate just below
+ * URM_TIME_MAX, so the longer timeouts become the longest possible one, and the duration that
+ * overflowed (see URMSensor::getCurrentDuration()) is over all of them.
+ */
+
+#ifdef URM_USE_TICK_TIMING
+
+#ifndef __AVR__
+	#error URM_USE_TICK_TIMING is only supported for AVR boards
+#endif
+
+#define URM_US_PER_TICK (URM_TIMER1_PRESCALER / (F_CPU / 1000000UL))
+
+#if (URM_US_PER_TICK == 0) || (URM_TIMER1_PRESCALER % (F_CPU / 1000000UL) != 0)
+	#error URM_USE_TICK_TIMING needs URM_TIMER1_PRESCALER giving whole microseconds per tick (64 on 16 MHz boards)
+#endif
+
+typedef uint16_t URMTime;
+
+#define URM_TIME_MAX 0xFFFF
+
+static inline URMTime urmNow()
+{
+	// Reading a 16-bit register of the timer goes through its shared TEMP register, so it must not
+	// be interrupted by the handler reading another one (like ICR1).
+	uint8_t savedSREG = SREG;
+	cli();
+	URMTime now = TCNT1;
+	SREG = savedSREG;
+
+	return now;
+}
+
+static inline unsigned long urmTimeToUs(URMTime time)
+{
+	return (unsigned long)time * URM_US_PER_TICK;
+}
+
+static inline URMTime urmUsToTime(unsigned long us)
+{
+	unsigned long ticks = us / URM_US_PER_TICK;
+	return (ticks < URM_TIME_MAX) ? (URMTime)ticks : (URM_TIME_MAX - 1);
+}
+
+#else
+
+typedef unsigned long URMTime;
+
+#define URM_TIME_MAX 0xFFFFFFFF
+
+static inline URMTime urmNow()
+{
+	return micros();
+}
+
+static inline unsigned long urmTimeToUs(URMTime time)
+{
+	return time;
+}
+
+static inline URMTime urmUsToTime(unsigned long us)
+{
+	return us;
+}
+
+#endif
+
+/**
+ * Time passed from since to now. The result is cast back to URMTime, since 16-bit values
+ * are promoted to int and their difference could be negative.
+ */
+static inline URMTime urmElapsed(URMTime now, URMTime since)
+{
+	return (URMTime)(now - since);
+}
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * Description:
+ * This sketch demonstrates how to work with several sensors using the URMSensorArray class.
+ * The array fires the sensors by itself, so the loop() function just has to call update()
+ * and print the distances when a sweep is over.
+ *
+ * Connections:
+ *    Pin 4 (Arduino) -> TRIG (front sensor)
+ *    Pin 5 (Arduino) -> ECHO (front sensor)
+ *    Pin 6 (Arduino) -> TRIG (rear sensor)
+ *    Pin 7 (Arduino) -> ECHO (rear sensor)
+ *    Pin 9 (Arduino) -> TRIG (left sensor)
+ *    Pin 10 (Arduino) -> ECHO (left sensor)
+ *    +5V (Arduino) -> VCC (all sensors)
+ *    GND (Arduino) -> GND (all sensors)
+ *
+ * Q: Why are the front and rear sensors in the same group?
+ * A: They look in opposite directions and can't hear each other, so it is safe to fire them
+ *    at the same time. The sweep then takes two measures instead of three.
+ *
+ * Have fun! :)
+ */
+
+#include <URMSensor.h>
+#include <URMSensorArray.h>
+
+// Serial port that will be used to output the information. You might want to change it
+// if you're using Arduino Leonardo or Arduino Mega with some wireless transceiver.
+#define TERMINAL Serial
+
+// Instances of the classes representing your ultrasonic sensors.
+HC_SR04 frontSensor;
+HC_SR04 rearSensor;
+HC_SR04 leftSensor;
+
+// The array that will drive all of them.
+URMSensorArray sensors;
+
+// Number of the last sweep that was printed.
+unsigned long lastPrintedSweep = 0;
+
+void setup()
+{
+  // Attaching the sensors to Arduino pins and initializing them...
+  frontSensor.attach(4, 5);
+  rearSensor.attach(6, 7);
+  leftSensor.attach(9, 10);
+
+  // ...and putting them into the array. Front and rear sensors are fired together.
+  sensors.addSensor(frontSensor, 0);
+  sensors.addSensor(rearSensor, 0);
+  sensors.addSensor(leftSensor, 1);
+
+  // ===================================================================================
+  // CHANGEME: Try lowering the guard time. If the sensors start to see each other's
+  //           echoes, the distances will jump around.
+  sensors.setGuardTime(50000);
+  // ===================================================================================
+
+  TERMINAL.begin(9600);
+  while (!TERMINAL) ;
+
+  TERMINAL.println("setup() is over, starting measures...");
+}
+
+void printDistance(const char* name, byte slot)
+{
+  TERMINAL.print(name);
+
+  unsigned long distance = sensors.getDistance(slot);
+  if (distance == URM_INVALID_VALUE)
+  {
+    TERMINAL.print("-- ");
+  }
+  else
+  {
+    TERMINAL.print(distance);
+    TERMINAL.print(" ");
+  }
+}
+
+void loop()
+{
+  sensors.update();
+
+  // Printing the distances once per sweep.
+  if (sensors.getSweepCount() != lastPrintedSweep)
+  {
+    printDistance("Front: ", 0);
+    printDistance("Rear: ", 1);
+    printDistance("Left: ", 2);
+    TERMINAL.println();
+
+    lastPrintedSweep = sensors.getSweepCount();
+  }
+}
@@ -56,7 +56,14 @@ void setup()
 {
   // Attaching the sensor to Arduino pins and initializing it.
   sensor.attach(URM_TRIG, URM_ECHO);
-  
+
+  // ===================================================================================
+  // CHANGEME: If you uncommented URM_USE_INTERRUPTS in URMSensor.h, uncomment the next
+  //           line. The sensor will catch the echo in its own interrupt handler, so
+  //           delays in loop() will no longer affect the accuracy of measurements.
+  // sensor.attachInterruptMode();
+  // ===================================================================================
+
   // Initializing the LED to be able to blink.
   pinMode(LED, OUTPUT);
   
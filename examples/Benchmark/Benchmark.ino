@@ -0,0 +1,375 @@
+/**
+ * Description:
+ * This sketch measures how long the library takes to do its work, in CPU cycles, and prints
+ * the table to the serial terminal. Use it to compare the configurations of URMSensor.h
+ * (URM_USE_PORTS_DIRECTLY, URM_USE_INTERRUPTS, URM_USE_INPUT_CAPTURE, URM_USE_TIMED_TRIGGER)
+ * and to check that your changes of the library did not make it slower.
+ *
+ * The sensor is not needed: the sketch makes the echo by itself on the STIMULUS pin, so you only
+ * have to connect it to the ECHO pin with a wire.
+ *
+ * Connections:
+ *    Pin 7 (Arduino) -> Pin 8 (Arduino)
+ *
+ * Q: Why does it only work on AVR boards?
+ * A: The cycles are counted by Timer2 (Uno, Nano, Mega, etc., but not Leonardo). The library
+ *    never uses Timer2, so every echo mode is measured with the timers set up the way
+ *    the library needs them.
+ *
+ * Q: Why is the ECHO pin 8?
+ * A: It is the input capture pin of Timer1 on Arduino Uno, so URM_USE_INPUT_CAPTURE can be tested
+ *    too. It also has the pin change interrupt for URM_USE_INTERRUPTS.
+ *
+ * Q: Why aren't the edge handling times printed?
+ * A: They are printed only if you uncomment URM_USE_INTERRUPTS or URM_USE_INPUT_CAPTURE
+ *    in URMSensor.h. They show how long the interrupt handler of the library takes.
+ *
+ * Have fun! :)
+ */
+
+#include <URMSensor.h>
+
+// Serial port that will be used to output the information. You might want to change it
+// if you're using Arduino Leonardo or Arduino Mega with some wireless transceiver.
+#define TERMINAL Serial
+
+// Pins used to communicate with the "sensor". The STIMULUS pin must be connected to the ECHO pin.
+#define URM_TRIG 9
+#define URM_ECHO 8
+#define STIMULUS 7
+
+// Every operation is measured this many times, and the fastest run is printed, so the interrupts
+// of the Arduino core (like the one counting millis()) don't spoil the results.
+#define REPEATS 32
+
+// Instance of the class representing the sensor. HC-SR04 has the shortest trigger pulse, so
+// startMeasure() spends less time just waiting.
+HC_SR04 sensor;
+
+// Environment used to measure the conversion with the speed of sound compensation.
+URMEnvironment environment;
+
+// The results are stored here, so the compiler can't throw away the operations.
+volatile unsigned long result;
+
+#if defined(__AVR__) && defined(TCCR2A)
+
+// Output register and mask of the STIMULUS pin, so the edges are made with a single instruction.
+volatile uint8_t* stimulusPort;
+uint8_t stimulusMask;
+
+// Input register and mask of the ECHO pin, to compare the direct port access with digitalRead().
+volatile uint8_t* echoPort;
+uint8_t echoMask;
+
+// Cycles taken by measure() itself, with the empty operation.
+unsigned int overhead = 0;
+
+// Timer2 counts only up to 255, so its overflows are counted here...
+volatile unsigned int overflowCount = 0;
+
+// ...and the cycles spent by this handler are taken out of the results.
+unsigned int overflowHandlerCycles = 0;
+
+ISR(TIMER2_OVF_vect)
+{
+  overflowCount++;
+}
+
+/**
+ * This function starts Timer2 counting every CPU cycle.
+ */
+void startCycleCounter()
+{
+  TCCR2A = 0;
+  TCCR2B = _BV(CS20);
+  TIFR2 = _BV(TOV2);
+  TIMSK2 = _BV(TOIE2);
+}
+
+/**
+ * This function returns the number of cycles counted by Timer2, and the number of its overflow
+ * handlers that were run so far.
+ */
+unsigned long readCycleCounter(unsigned int& handledOverflows)
+{
+  uint8_t savedSREG = SREG;
+  cli();
+
+  uint8_t low = TCNT2;
+  handledOverflows = overflowCount;
+
+  // The overflow that came after the interrupts were disabled is not handled yet.
+  unsigned long high = handledOverflows;
+  if ((TIFR2 & _BV(TOV2)) && (low < 255)) high++;
+
+  SREG = savedSREG;
+
+  return (high << 8) | low;
+}
+
+/**
+ * This function runs the operation once and returns the number of cycles it took, without
+ * the overflow handlers of Timer2.
+ */
+unsigned long countCycles(void (*operation)())
+{
+  unsigned int startOverflows;
+  unsigned int endOverflows;
+
+  unsigned long start = readCycleCounter(startOverflows);
+  operation();
+  unsigned long cycles = readCycleCounter(endOverflows) - start;
+
+  return cycles - (unsigned long)(endOverflows - startOverflows) * overflowHandlerCycles;
+}
+
+/**
+ * This function runs the operation REPEATS times, each time after the preparation,
+ * and returns the smallest number of cycles it took.
+ */
+unsigned int measure(void (*prepare)(), void (*operation)())
+{
+  unsigned long best = 0xFFFF;
+
+  for (byte i = 0; i < REPEATS; i++)
+  {
+    prepare();
+
+    unsigned long cycles = countCycles(operation);
+    if (cycles < best) best = cycles;
+  }
+
+  return (best > overhead) ? (best - overhead) : 0;
+}
+
+// Exactly CALIBRATION_CYCLES cycles, so the overflow handlers are the only thing on top of them.
+#define CALIBRATION_CYCLES 4096
+
+void waitCalibrationCycles()
+{
+  __builtin_avr_delay_cycles(CALIBRATION_CYCLES);
+}
+
+/**
+ * This function finds out how many cycles the overflow handler of Timer2 takes. Call it after
+ * the overhead is measured: the delay is long enough to be interrupted many times. The other
+ * interrupts (like the one counting millis()) may come in too, so the smallest result is taken.
+ */
+void calibrateCycleCounter()
+{
+  unsigned int best = 0xFFFF;
+
+  for (byte i = 0; i < REPEATS; i++)
+  {
+    unsigned int startOverflows;
+    unsigned int endOverflows;
+
+    unsigned long start = readCycleCounter(startOverflows);
+    waitCalibrationCycles();
+    unsigned long cycles = readCycleCounter(endOverflows) - start;
+
+    unsigned int handlerCount = endOverflows - startOverflows;
+    if ((handlerCount == 0) || (cycles <= CALIBRATION_CYCLES + overhead)) continue;
+
+    unsigned int handlerCycles = (cycles - CALIBRATION_CYCLES - overhead) / handlerCount;
+    if (handlerCycles < best) best = handlerCycles;
+  }
+
+  if (best != 0xFFFF) overflowHandlerCycles = best;
+}
+
+// ====== Preparations: they put the sensor into the state the operation needs ======================
+
+void stimulusLow()
+{
+  *stimulusPort &= ~stimulusMask;
+}
+
+void stimulusHigh()
+{
+  *stimulusPort |= stimulusMask;
+}
+
+void prepareNothing()
+{
+}
+
+void prepareIdle()
+{
+  sensor.interruptMeasure();
+  stimulusLow();
+}
+
+void prepareWaitingForPulse()
+{
+  prepareIdle();
+  sensor.startMeasure();
+}
+
+void preparePulseStart()
+{
+  prepareWaitingForPulse();
+  stimulusHigh();
+}
+
+void prepareMeasuring()
+{
+  preparePulseStart();
+  sensor.refreshState();
+}
+
+void preparePulseEnd()
+{
+  prepareMeasuring();
+  delayMicroseconds(100);
+  stimulusLow();
+}
+
+void prepareFinishedMeasure()
+{
+  preparePulseEnd();
+  sensor.refreshState();
+  sensor.setEnvironment(NULL);
+}
+
+void prepareFinishedMeasureWithEnvironment()
+{
+  prepareFinishedMeasure();
+  sensor.setEnvironment(&environment);
+}
+
+// ====== Operations ================================================================================
+
+void doNothing()
+{
+}
+
+void readWithDigitalRead()
+{
+  result = digitalRead(URM_ECHO);
+}
+
+void readWithPort()
+{
+  result = ((*echoPort & echoMask) != 0) ? HIGH : LOW;
+}
+
+void refreshState()
+{
+  sensor.refreshState();
+}
+
+void startMeasure()
+{
+  sensor.startMeasure();
+}
+
+void getDistance()
+{
+  result = sensor.getMeasuredDistance();
+}
+
+void getDistanceMm()
+{
+  result = sensor.getMeasuredDistanceMm();
+}
+
+// The edge is made with interrupts enabled, and a few spare cycles let the interrupt handler
+// start before the counter is read.
+void makeEdge()
+{
+  stimulusHigh();
+  __asm__ __volatile__ ("nop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\tnop\n\t");
+}
+
+/**
+ * This function measures everything that works in the current echo mode.
+ */
+void runEchoModeBenchmarks()
+{
+  printRow("refreshState(), Idle", measure(prepareIdle, refreshState));
+  printRow("refreshState(), WaitingForPulse", measure(prepareWaitingForPulse, refreshState));
+  printRow("refreshState(), WaitingForPulse -> Measuring", measure(preparePulseStart, refreshState));
+  printRow("refreshState(), Measuring", measure(prepareMeasuring, refreshState));
+  printRow("refreshState(), Measuring -> FinishedMeasure", measure(preparePulseEnd, refreshState));
+  printRow("refreshState(), FinishedMeasure", measure(prepareFinishedMeasure, refreshState));
+  printRow("startMeasure()", measure(prepareIdle, startMeasure));
+  printRow("Echo edge", measure(prepareWaitingForPulse, makeEdge));
+}
+
+#endif
+
+void setup()
+{
+  TERMINAL.begin(9600);
+  while (!TERMINAL) ;
+
+#if !defined(__AVR__) || !defined(TCCR2A)
+  TERMINAL.println("Sorry, this benchmark works only on AVR boards with Timer2.");
+#else
+  pinMode(STIMULUS, OUTPUT);
+  digitalWrite(STIMULUS, LOW);
+
+  stimulusPort = portOutputRegister(digitalPinToPort(STIMULUS));
+  stimulusMask = digitalPinToBitMask(STIMULUS);
+
+  echoPort = portInputRegister(digitalPinToPort(URM_ECHO));
+  echoMask = digitalPinToBitMask(URM_ECHO);
+
+  sensor.attach(URM_TRIG, URM_ECHO);
+
+  startCycleCounter();
+  overhead = measure(prepareNothing, doNothing);
+  calibrateCycleCounter();
+
+#ifdef URM_USE_PORTS_DIRECTLY
+  TERMINAL.println("URM_USE_PORTS_DIRECTLY is on");
+#else
+  TERMINAL.println("URM_USE_PORTS_DIRECTLY is off");
+#endif
+
+  TERMINAL.println("Operation                                   Cycles\tus");
+
+  // Reading the pin: the library itself reads the ECHO pin like the first line when
+  // URM_USE_PORTS_DIRECTLY is on, and like the second one otherwise.
+  printRow("ECHO read, port register", measure(prepareNothing, readWithPort));
+  printRow("ECHO read, digitalRead()", measure(prepareNothing, readWithDigitalRead));
+
+  // Converting the pulse width to distance.
+  printRow("getMeasuredDistance()", measure(prepareFinishedMeasure, getDistance));
+  printRow("getMeasuredDistanceMm()", measure(prepareFinishedMeasure, getDistanceMm));
+  printRow("getMeasuredDistance(), with environment", measure(prepareFinishedMeasureWithEnvironment, getDistance));
+  printRow("getMeasuredDistanceMm(), with environment", measure(prepareFinishedMeasureWithEnvironment, getDistanceMm));
+  sensor.setEnvironment(NULL);
+
+  // The state machine in every echo mode available. In polling mode, "Echo edge" is just
+  // the cost of making the edge, so subtract it from the same line of other modes.
+  TERMINAL.println("--- Polling mode");
+  runEchoModeBenchmarks();
+
+#ifdef URM_USE_INTERRUPTS
+  if (sensor.attachInterruptMode())
+  {
+    TERMINAL.println("--- Interrupt mode");
+    runEchoModeBenchmarks();
+    sensor.detachInterruptMode();
+  }
+#endif
+
+#ifdef URM_USE_INPUT_CAPTURE
+  if (sensor.attachInputCaptureMode())
+  {
+    TERMINAL.println("--- Input capture mode");
+    runEchoModeBenchmarks();
+    sensor.detachInputCaptureMode();
+  }
+#endif
+
+  TERMINAL.println("Done.");
+#endif
+}
+
+void loop()
+{
+}
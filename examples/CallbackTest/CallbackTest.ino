@@ -0,0 +1,82 @@
+/**
+ * Description:
+ * This sketch demonstrates how to get the results of the measures without checking the state
+ * of the sensor by yourself. The sensor measures the distance continuously, and dispatch()
+ * calls printDistance() exactly once when the measure is over. The loop() function is free
+ * to do anything else in the meantime.
+ *
+ * Connections:
+ *    Pin 9 (Arduino) -> TRIG (URM sensor)
+ *    Pin 10 (Arduino) -> ECHO (URM sensor)
+ *    +5V (Arduino) -> VCC (URM sensor)
+ *    GND (Arduino) -> GND (URM sensor)
+ *
+ * Q: Can I use the same function for several sensors?
+ * A: Yes. Pass different identifiers to onMeasurementComplete(), and the function will get them
+ *    as its first argument. URMSensorArray does the same with the slot numbers.
+ *
+ * Have fun! :)
+ */
+
+#include <URMSensor.h>
+
+// Serial port that will be used to output the information. You might want to change it
+// if you're using Arduino Leonardo or Arduino Mega with some wireless transceiver.
+#define TERMINAL Serial
+
+// Pins used to communicate with the sensor.
+#define URM_TRIG 9
+#define URM_ECHO 10
+
+// Instance of the class representing your ultrasonic sensor.
+// ===================================================================================
+// CHANGEME: Uncomment one of the following lines to select which sensor you will use.
+
+// HC_SR04 sensor;
+URM37 sensor;
+// ===================================================================================
+
+/**
+ * This function is called by sensor.dispatch() when the measure is over.
+ */
+void printDistance(byte id, unsigned long distance, byte status)
+{
+  if (status == StatusOk)
+  {
+    TERMINAL.print("Measured distance: ");
+    TERMINAL.println(distance);
+  }
+  else
+  {
+    TERMINAL.print("Failed to read distance, status: ");
+    TERMINAL.println(status);
+  }
+}
+
+void setup()
+{
+  // Attaching the sensor to Arduino pins and initializing it...
+  sensor.attach(URM_TRIG, URM_ECHO);
+
+  // ...telling it what to do with the results...
+  sensor.onMeasurementComplete(printDistance);
+
+  // ...and starting the measures twice a second.
+  // ===================================================================================
+  // CHANGEME: Try replacing 500000 with some other value (in microseconds).
+  sensor.startContinuousMeasure(500000);
+  // ===================================================================================
+
+  TERMINAL.begin(9600);
+  while (!TERMINAL) ;
+
+  TERMINAL.println("setup() is over, starting measures...");
+}
+
+void loop()
+{
+  // Refreshing the state of the sensor, and calling printDistance() if the measure is over.
+  sensor.dispatch();
+
+  // Put your own code here, just be sure that it does not take too long to run.
+}
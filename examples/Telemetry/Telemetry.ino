@@ -0,0 +1,83 @@
+/**
+ * Description:
+ * This sketch demonstrates how to stream every measure of the array to a PC with the URMTelemetry
+ * class. The measures are sent in the compact binary format instead of the text, so the serial
+ * port keeps up with the sensors, and loop() never waits for it.
+ *
+ * The results are taken from the sample buffers of the sensors, so uncomment URM_SAMPLE_BUFFER_SIZE
+ * in URMSensor.h first. Every sample keeps the raw pulse width with the time the measure was taken,
+ * so nothing depends on how soon loop() gets to it.
+ *
+ * The stream is not readable in the Serial Monitor: decode it on the PC with the script from
+ * the extras/telemetry folder of the library, for example:
+ *    python3 urm_telemetry.py --port /dev/ttyUSB0 > measures.csv
+ *
+ * Connections:
+ *    Pin 4 (Arduino) -> TRIG (front sensor)
+ *    Pin 5 (Arduino) -> ECHO (front sensor)
+ *    Pin 6 (Arduino) -> TRIG (rear sensor)
+ *    Pin 7 (Arduino) -> ECHO (rear sensor)
+ *    +5V (Arduino) -> VCC (all sensors)
+ *    GND (Arduino) -> GND (all sensors)
+ *
+ * Q: Why do I need to call flush() all the time?
+ * A: flush() only writes as many bytes as fit into the transmit buffer of the serial port,
+ *    so it returns right away. The rest stays in the telemetry buffer till the next call.
+ *
+ * Q: What happens if the port is too slow?
+ * A: The samples wait in the sample buffers of the sensors while the telemetry buffer is full.
+ *    When those are full too, the new measures are dropped, and getDroppedSampleCount() tells
+ *    how many were lost. The decoder sees the gap in the timestamps.
+ *
+ * Have fun! :)
+ */
+
+#include <URMSensor.h>
+#include <URMSensorArray.h>
+#include <URMTelemetry.h>
+
+#ifndef URM_SAMPLE_BUFFER_SIZE
+  #error "The sketch streams the sample buffers of the sensors, so URM_SAMPLE_BUFFER_SIZE must be defined in URMSensor.h"
+#endif
+
+// Serial port that will be used to output the measures.
+#define TERMINAL Serial
+
+// Instances of the classes representing your ultrasonic sensors.
+HC_SR04 frontSensor;
+HC_SR04 rearSensor;
+
+// The array that will drive both of them.
+URMSensorArray sensors;
+
+// The telemetry stream.
+URMTelemetry telemetry(TERMINAL);
+
+void setup()
+{
+  // Attaching the sensors to Arduino pins and initializing them...
+  frontSensor.attach(4, 5);
+  rearSensor.attach(6, 7);
+
+  // ...and putting them into the array. They look in opposite directions, so they are fired together.
+  sensors.addSensor(frontSensor, 0);
+  sensors.addSensor(rearSensor, 0);
+  sensors.setGuardTime(30000);
+
+  // ===================================================================================
+  // CHANGEME: The faster the port, the more sensors it can stream. Every measure takes
+  //           9 bytes, that is less than 1 ms at 115200 baud.
+  TERMINAL.begin(115200);
+  // ===================================================================================
+  while (!TERMINAL) ;
+}
+
+void loop()
+{
+  sensors.update();
+
+  // The raw pulse widths are sent, so the PC can convert them with any speed of sound it likes.
+  telemetry.addSamples(0, frontSensor);
+  telemetry.addSamples(1, rearSensor);
+  telemetry.flush();
+}
@@ -0,0 +1,250 @@
+#include "URMSimulatedHal.h"
+
+#include <stdio.h>
+
+volatile uint8_t urmSimPortRegisters[URM_SIM_PORT_COUNT][3];
+
+URMSimulatedSerial Serial;
+
+struct URMSimulatedEcho
+{
+	byte trigPin;
+	byte echoPin;
+	byte trigActiveState;
+	byte echoActiveState;
+	unsigned long latency;
+	URMSimulatedEchoScript script;
+
+	boolean trigWasActive;
+	boolean isScheduled;
+	unsigned long echoStart;
+	unsigned long echoWidth;
+};
+
+static unsigned long urmSimTime;
+
+static URMSimulatedEcho urmSimEchoes[URM_SIM_MAX_ECHOES];
+static byte urmSimEchoCount;
+
+// External level of every pin (driven by the simulated sensors). The input pins nobody drives
+// read as their PORTx bit, just like with the pull-up resistor.
+static boolean urmSimIsDriven[URM_SIM_PIN_COUNT];
+static byte urmSimDrivenLevel[URM_SIM_PIN_COUNT];
+
+static byte urmSimOutputLevel(byte pin)
+{
+	return (urmSimPortRegisters[digitalPinToPort(pin)][0] & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+static void urmSimUpdatePins()
+{
+	for (byte i = 0; i < urmSimEchoCount; i++)
+	{
+		URMSimulatedEcho& echo = urmSimEchoes[i];
+
+		// The sensor starts when the trigger pulse ends.
+		boolean trigIsActive = (urmSimOutputLevel(echo.trigPin) == echo.trigActiveState);
+		if (echo.trigWasActive && !trigIsActive)
+		{
+			echo.echoWidth = echo.script(echo.echoPin, urmSimTime);
+			echo.echoStart = urmSimTime + echo.latency;
+			echo.isScheduled = (echo.echoWidth != 0);
+		}
+		echo.trigWasActive = trigIsActive;
+
+		// Comparing the differences, so the pulse works across the wraparound of the clock too:
+		// the echo has started if the time since its start is not "negative".
+		boolean echoIsActive = false;
+		unsigned long elapsed = urmSimTime - echo.echoStart;
+
+		if (echo.isScheduled && (elapsed <= (unsigned long)-1 / 2))
+		{
+			echoIsActive = (elapsed < echo.echoWidth);
+			if (!echoIsActive) echo.isScheduled = false;
+		}
+
+		urmSimIsDriven[echo.echoPin] = true;
+		urmSimDrivenLevel[echo.echoPin] = echoIsActive ? echo.echoActiveState : 
+			((echo.echoActiveState == HIGH) ? LOW : HIGH);
+	}
+
+	// PINx shows the level of every pin: the outputs and the undriven inputs show PORTx.
+	for (byte port = 0; port < URM_SIM_PORT_COUNT; port++)
+	{
+		uint8_t levels = urmSimPortRegisters[port][0];
+
+		for (byte bit = 0; bit < 8; bit++)
+		{
+			byte pin = port * 8 + bit;
+			boolean isOutput = (urmSimPortRegisters[port][2] & (1 << bit)) != 0;
+
+			if (!isOutput && urmSimIsDriven[pin])
+			{
+				if (urmSimDrivenLevel[pin] == HIGH) levels |= (1 << bit);
+				else levels &= ~(1 << bit);
+			}
+		}
+
+		urmSimPortRegisters[port][1] = levels;
+	}
+}
+
+// ====== Arduino API ============================================================================
+
+unsigned long micros()
+{
+	return urmSimTime;
+}
+
+unsigned long millis()
+{
+	return urmSimTime / 1000;
+}
+
+void delay(unsigned long ms)
+{
+	urmSimAdvance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	urmSimAdvance(us);
+}
+
+void pinMode(byte pin, byte mode)
+{
+	if (pin >= URM_SIM_PIN_COUNT) return;
+
+	volatile uint8_t* ddr = portModeRegister(digitalPinToPort(pin));
+	volatile uint8_t* port = portOutputRegister(digitalPinToPort(pin));
+	uint8_t mask = digitalPinToBitMask(pin);
+
+	if (mode == OUTPUT) *ddr |= mask;
+	else *ddr &= ~mask;
+
+	if (mode == INPUT_PULLUP) *port |= mask;
+	else if (mode == INPUT) *port &= ~mask;
+
+	urmSimUpdatePins();
+}
+
+int digitalRead(byte pin)
+{
+	if (pin >= URM_SIM_PIN_COUNT) return LOW;
+
+	urmSimUpdatePins();
+	return (*portInputRegister(digitalPinToPort(pin)) & digitalPinToBitMask(pin)) ? HIGH : LOW;
+}
+
+void digitalWrite(byte pin, byte value)
+{
+	if (pin >= URM_SIM_PIN_COUNT) return;
+
+	volatile uint8_t* port = portOutputRegister(digitalPinToPort(pin));
+	if (value == HIGH) *port |= digitalPinToBitMask(pin);
+	else *port &= ~digitalPinToBitMask(pin);
+
+	urmSimUpdatePins();
+}
+
+void noInterrupts()
+{
+}
+
+void interrupts()
+{
+}
+
+void yield()
+{
+}
+
+// ====== Print ==================================================================================
+
+size_t Print::write(const uint8_t* buffer, size_t size)
+{
+	size_t count = 0;
+	while (size--) count += write(*buffer++);
+	return count;
+}
+
+size_t Print::print(const char* text)
+{
+	size_t count = 0;
+	while (*text) count += write(*text++);
+	return count;
+}
+
+size_t Print::print(unsigned long value)
+{
+	char buffer[24];
+	snprintf(buffer, sizeof(buffer), "%lu", value);
+	return print(buffer);
+}
+
+size_t Print::print(long value)
+{
+	char buffer[24];
+	snprintf(buffer, sizeof(buffer), "%ld", value);
+	return print(buffer);
+}
+
+size_t Print::print(double value, int digits)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+	return print(buffer);
+}
+
+size_t URMSimulatedSerial::write(uint8_t c)
+{
+	return (putchar(c) == EOF) ? 0 : 1;
+}
+
+// ====== Simulation control =====================================================================
+
+void urmSimReset()
+{
+	memset((void*)urmSimPortRegisters, 0, sizeof(urmSimPortRegisters));
+
+	for (byte pin = 0; pin < URM_SIM_PIN_COUNT; pin++) urmSimIsDriven[pin] = false;
+
+	urmSimEchoCount = 0;
+	urmSimTime = 0;
+}
+
+void urmSimSetTime(unsigned long now)
+{
+	urmSimTime = now;
+
+	// Nothing scheduled before can be compared with the new time.
+	for (byte i = 0; i < urmSimEchoCount; i++) urmSimEchoes[i].isScheduled = false;
+
+	urmSimUpdatePins();
+}
+
+void urmSimAdvance(unsigned long us)
+{
+	urmSimTime += us;
+	urmSimUpdatePins();
+}
+
+boolean urmSimAddEcho(byte trigPin, byte echoPin, URMSimulatedEchoScript script,
+	byte trigActiveState, byte echoActiveState, unsigned long latency)
+{
+	if ((urmSimEchoCount == URM_SIM_MAX_ECHOES) || (trigPin >= URM_SIM_PIN_COUNT) ||
+		(echoPin >= URM_SIM_PIN_COUNT)) return false;
+
+	URMSimulatedEcho& echo = urmSimEchoes[urmSimEchoCount++];
+	echo.trigPin = trigPin;
+	echo.echoPin = echoPin;
+	echo.trigActiveState = trigActiveState;
+	echo.echoActiveState = echoActiveState;
+	echo.latency = latency;
+	echo.script = script;
+	echo.trigWasActive = false;
+	echo.isScheduled = false;
+
+	urmSimUpdatePins();
+	return true;
+}
@@ -0,0 +1,159 @@
+#ifndef URMSIMULATEDHAL_H
+#define URMSIMULATEDHAL_H
+
+/**
+ * Simulated replacement of the Arduino core for running the library on a PC (see URMHal.h).
+ * It has a clock that moves only when you tell it to (or when the library waits with
+ * delayMicroseconds()), 4 ports of 8 pins with the same registers as AVR has, and simulated
+ * sensors that answer the trigger pulses with the echo pulses you script.
+ *
+ * Only the polling mode is simulated: URM_USE_INTERRUPTS and Timer1 backends need real hardware.
+ *
+ * @author Andrey A. Vasenev
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define F_CPU 16000000UL
+
+/**
+ * Number of simulated ports. Pins are numbered from 0, 8 of them per port.
+ */
+#define URM_SIM_PORT_COUNT 4
+#define URM_SIM_PIN_COUNT (URM_SIM_PORT_COUNT * 8)
+
+/**
+ * Maximal number of simulated sensors.
+ */
+#define URM_SIM_MAX_ECHOES 8
+
+/**
+ * Default time between the end of the trigger pulse and the start of the echo pulse, in microseconds.
+ */
+#define URM_SIM_DEFAULT_ECHO_LATENCY 400 // us
+
+// ====== Arduino API ============================================================================
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(byte pin, byte mode);
+int digitalRead(byte pin);
+void digitalWrite(byte pin, byte value);
+
+void noInterrupts();
+void interrupts();
+void yield();
+
+// Registers of the ports: PORTx, PINx and DDRx, like on AVR.
+extern volatile uint8_t urmSimPortRegisters[URM_SIM_PORT_COUNT][3];
+
+#define digitalPinToPort(pin) ((byte)((pin) >> 3))
+#define digitalPinToBitMask(pin) ((uint8_t)(1 << ((pin) & 7)))
+#define portOutputRegister(port) (&urmSimPortRegisters[port][0])
+#define portInputRegister(port) (&urmSimPortRegisters[port][1])
+#define portModeRegister(port) (&urmSimPortRegisters[port][2])
+
+/**
+ * Minimal version of the Arduino Print class, enough for the library and the simulation.
+ */
+class Print
+{
+	public:
+		virtual ~Print() {}
+
+		virtual size_t write(uint8_t c) = 0;
+		virtual size_t write(const uint8_t* buffer, size_t size);
+
+		// The real ports report the free space of their transmit buffer.
+		virtual int availableForWrite() { return 0; }
+
+		size_t print(const char* text);
+		size_t print(char c) { return write(c); }
+		size_t print(unsigned long value);
+		size_t print(long value);
+		size_t print(unsigned int value) { return print((unsigned long)value); }
+		size_t print(int value) { return print((long)value); }
+		size_t print(double value, int digits = 2);
+
+		size_t println() { return print("\n"); }
+
+		template <class T>
+		size_t println(T value) { return print(value) + println(); }
+
+		size_t println(double value, int digits) { return print(value, digits) + println(); }
+};
+
+/**
+ * Print writing to the standard output.
+ */
+class URMSimulatedSerial : public Print
+{
+	public:
+		void begin(unsigned long) {}
+		operator bool() { return true; }
+
+		virtual size_t write(uint8_t c);
+
+		// The standard output never makes the caller wait.
+		virtual int availableForWrite() { return 64; }
+};
+
+extern URMSimulatedSerial Serial;
+
+// ====== Simulation control =====================================================================
+
+/**
+ * Function that tells what the simulated sensor hears. It is called at the end of every trigger
+ * pulse.
+ *
+ * @param echoPin ECHO pin of the sensor.
+ *
+ * @param triggerTime Time when the trigger pulse ended, as returned by micros().
+ *
+ * @return Width of the echo pulse in microseconds, or 0 if the sensor does not answer.
+ */
+typedef unsigned long (*URMSimulatedEchoScript)(byte echoPin, unsigned long triggerTime);
+
+/**
+ * Puts all pins and the clock to their initial state, and removes all simulated sensors.
+ */
+void urmSimReset();
+
+/**
+ * Sets the clock. Set it close to the largest unsigned long value to see how the library handles
+ * the wraparound of micros().
+ */
+void urmSimSetTime(unsigned long now);
+
+/**
+ * Moves the clock forward and updates the ECHO pins of the simulated sensors.
+ */
+void urmSimAdvance(unsigned long us);
+
+/**
+ * Connects the simulated sensor to the pins. The echo starts the given time after the trigger
+ * pulse ends (as seen by the next urmSimAdvance() call, since the library may write the TRIG pin
+ * registers directly).
+ *
+ * @return false if there are already URM_SIM_MAX_ECHOES sensors.
+ */
+boolean urmSimAddEcho(byte trigPin, byte echoPin, URMSimulatedEchoScript script,
+	byte trigActiveState = HIGH, byte echoActiveState = HIGH,
+	unsigned long latency = URM_SIM_DEFAULT_ECHO_LATENCY);
+
+#endif
@@ -0,0 +1,203 @@
+/**
+ * Runs the library against the simulated sensors (see URMSimulatedHal.h) and prints how well
+ * it measured the scripted distances, and how fast it works on this PC. See README.md for
+ * the build instructions.
+ *
+ * Returns the number of failed scenarios, so it can be used in scripts.
+ */
+
+#include "URMSensor.h"
+#include "URMSensorArray.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Time step of the simulation: the library sees every edge at most this late.
+#define STEP 5 // us
+
+// Pulse width of 1 cm for the simulated sensors.
+#define SIMULATED_US_PER_CM HC_SR04_US_PER_CM
+
+static unsigned long distances[URM_SIM_PIN_COUNT];
+static unsigned long spikeEvery = 0;
+static unsigned long echoCount = 0;
+
+/**
+ * The target is at the distance set for the ECHO pin. Every spikeEvery-th echo comes from
+ * the "neighbour" at 20 cm.
+ */
+static unsigned long scriptedEcho(byte echoPin, unsigned long)
+{
+	echoCount++;
+
+	if ((spikeEvery != 0) && (echoCount % spikeEvery == 0)) return 20 * SIMULATED_US_PER_CM;
+
+	return distances[echoPin] * SIMULATED_US_PER_CM;
+}
+
+static boolean isClose(unsigned long measured, unsigned long expected)
+{
+	// The latency of the time step may cost a centimeter.
+	return (measured != URM_INVALID_VALUE) && (measured + 1 >= expected) && (measured <= expected + 1);
+}
+
+static boolean report(const char* name, unsigned long count, unsigned long failures)
+{
+	printf("%-48s %s (%lu measures, %lu wrong)\n", name, (failures == 0) ? "OK  " : "FAIL", count, failures);
+	return failures == 0;
+}
+
+/**
+ * Single sensor measuring the target approaching from 3 m to 20 cm, started at the given time.
+ */
+static boolean runSingleSensor(const char* name, unsigned long startTime)
+{
+	urmSimReset();
+	urmSimAddEcho(9, 10, scriptedEcho);
+	urmSimSetTime(startTime);
+
+	HC_SR04 sensor;
+	sensor.attach(9, 10);
+
+	unsigned long count = 0, failures = 0;
+	spikeEvery = 0;
+
+	for (unsigned long expected = 300; expected >= 20; expected -= 7)
+	{
+		distances[10] = expected;
+
+		sensor.startMeasure();
+		while (!sensor.finishedMeasure()) urmSimAdvance(STEP);
+
+		count++;
+		if (!isClose(sensor.getMeasuredDistance(), expected)) failures++;
+
+		// HC-SR04 needs some rest before the next measure.
+		urmSimAdvance(60000);
+	}
+
+	return report(name, count, failures);
+}
+
+/**
+ * The sensor that does not answer must fail with StatusNoEcho, even across the wraparound.
+ */
+static boolean runNoEcho()
+{
+	urmSimReset();
+	urmSimSetTime((unsigned long)-1 - 10000);
+
+	HC_SR04 sensor;
+	sensor.attach(9, 10);
+
+	unsigned long count = 0, failures = 0;
+
+	for (byte i = 0; i < 5; i++)
+	{
+		sensor.startMeasure();
+		while (!sensor.finishedMeasure()) urmSimAdvance(STEP);
+
+		count++;
+		if ((sensor.getStatus() != StatusNoEcho) || (sensor.getMeasuredDistance() != URM_INVALID_VALUE)) failures++;
+	}
+
+	return report("No echo, across micros() wraparound", count, failures);
+}
+
+/**
+ * Three sensors in two groups, with every 5th echo replaced by a spike and filtered out
+ * by the median of 3.
+ */
+static boolean runFilteredArray()
+{
+	urmSimReset();
+	urmSimAddEcho(4, 5, scriptedEcho);
+	urmSimAddEcho(6, 7, scriptedEcho);
+	urmSimAddEcho(17, 18, scriptedEcho);
+
+	distances[5] = 100;
+	distances[7] = 50;
+	distances[18] = 250;
+
+	HC_SR04 front, rear, left;
+	front.attach(4, 5);
+	rear.attach(6, 7);
+	left.attach(17, 18);
+
+	URMFilter filters[3];
+
+	URMSensorArray sensors;
+	sensors.addSensor(front, 0);
+	sensors.addSensor(rear, 0);
+	sensors.addSensor(left, 1);
+	sensors.setGuardTime(60000);
+
+	for (byte slot = 0; slot < 3; slot++) sensors.setFilter(slot, &filters[slot]);
+
+	spikeEvery = 5;
+	echoCount = 0;
+
+	unsigned long count = 0, failures = 0;
+	unsigned long lastSweep = 0;
+
+	while (count < 3 * 50)
+	{
+		sensors.update();
+		urmSimAdvance(STEP);
+
+		if (sensors.getSweepCount() == lastSweep) continue;
+		lastSweep = sensors.getSweepCount();
+
+		// The first sweeps fill the median window.
+		if (lastSweep < 3) continue;
+
+		if (!isClose(sensors.getFilteredDistance(0), 100)) failures++;
+		if (!isClose(sensors.getFilteredDistance(1), 50)) failures++;
+		if (!isClose(sensors.getFilteredDistance(2), 250)) failures++;
+		count += 3;
+	}
+
+	spikeEvery = 0;
+	return report("Array with spikes, median of 3", count, failures);
+}
+
+/**
+ * Measures how many times per second refreshState() can be called on this PC.
+ */
+static void runThroughput()
+{
+	urmSimReset();
+	urmSimAddEcho(9, 10, scriptedEcho);
+	distances[10] = 150;
+
+	HC_SR04 sensor;
+	sensor.attach(9, 10);
+	sensor.startContinuousMeasure(60000);
+
+	const unsigned long refreshCount = 10000000;
+
+	clock_t start = clock();
+	for (unsigned long i = 0; i < refreshCount; i++)
+	{
+		sensor.refreshState();
+		urmSimAdvance(1);
+	}
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("Throughput: %.1f million refreshes per second (%u measures in %.1f s of simulated time)\n",
+		refreshCount / seconds / 1e6, sensor.getSequenceNumber(), refreshCount / 1e6);
+}
+
+int main()
+{
+	int failedCount = 0;
+
+	if (!runSingleSensor("Single sensor, approaching target", 0)) failedCount++;
+	if (!runSingleSensor("Single sensor, across micros() wraparound", (unsigned long)-1 - 500000)) failedCount++;
+	if (!runNoEcho()) failedCount++;
+	if (!runFilteredArray()) failedCount++;
+
+	runThroughput();
+
+	return failedCount;
+}
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Decodes the URMTelemetry stream into CSV (see README.md for the format)."""
+
+import argparse
+import struct
+import sys
+
+SYNC = 0xA5
+FRAME_MEASUREMENT = 0x01
+FRAME_TIME = 0x02
+
+PAYLOAD_LENGTHS = {FRAME_MEASUREMENT: 6, FRAME_TIME: 4}
+
+INVALID_WIDTH = 0xFFFF
+
+STATUSES = ["None", "Measuring", "Ok", "Interrupted", "NotAttached", "EchoStuck",
+            "NoEcho", "PulseTooLong", "OutOfRange", "Rejected"]
+
+
+def crc8(data):
+    crc = 0
+    for value in data:
+        crc ^= value
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x07) & 0xFF if crc & 0x80 else (crc << 1) & 0xFF
+    return crc
+
+
+class Decoder:
+    """Turns the bytes into (time, id, pulse width or None, status) tuples."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.time = None
+        self.bad_frames = 0
+
+    def feed(self, data):
+        self.buffer.extend(data)
+        records = []
+
+        while True:
+            start = self.buffer.find(bytes([SYNC]))
+            if start < 0:
+                self.buffer.clear()
+                break
+            del self.buffer[:start]
+
+            if len(self.buffer) < 2:
+                break
+
+            frame_type = self.buffer[1]
+            length = PAYLOAD_LENGTHS.get(frame_type)
+            if length is None:
+                self.drop_sync()
+                continue
+
+            if len(self.buffer) < length + 3:
+                break
+
+            body = bytes(self.buffer[1:length + 2])
+            if crc8(body) != self.buffer[length + 2]:
+                self.drop_sync()
+                continue
+
+            del self.buffer[:length + 3]
+            record = self.parse(frame_type, body[1:])
+            if record is not None:
+                records.append(record)
+
+        return records
+
+    def drop_sync(self):
+        self.bad_frames += 1
+        del self.buffer[:1]
+
+    def parse(self, frame_type, payload):
+        if frame_type == FRAME_TIME:
+            (self.time,) = struct.unpack("<I", payload)
+            return None
+
+        sensor_id, delta, width, status = struct.unpack("<BhHB", payload)
+        if self.time is None:
+            return None
+
+        self.time = (self.time + delta) & 0xFFFFFFFF
+        return (self.time, sensor_id, None if width == INVALID_WIDTH else width, status)
+
+
+def open_input(args):
+    if args.port:
+        import serial
+        port = serial.Serial(args.port, args.baud, timeout=0.1)
+        return lambda: port.read(256)
+
+    stream = open(args.file, "rb") if args.file else sys.stdin.buffer
+    return lambda: stream.read1(4096) if hasattr(stream, "read1") else stream.read(4096)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("file", nargs="?", help="captured stream (standard input if omitted)")
+    parser.add_argument("--port", help="serial port to read from (needs pyserial)")
+    parser.add_argument("--baud", type=int, default=115200, help="baud rate of the port")
+    args = parser.parse_args()
+
+    read = open_input(args)
+    decoder = Decoder()
+
+    print("time_us,id,pulse_width_us,status")
+    try:
+        while True:
+            data = read()
+            if not data:
+                if args.port:
+                    continue
+                break
+
+            for time, sensor_id, width, status in decoder.feed(data):
+                name = STATUSES[status] if status < len(STATUSES) else str(status)
+                print("%d,%d,%s,%s" % (time, sensor_id, "" if width is None else width, name))
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+
+    print("bad frames: %d" % decoder.bad_frames, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()